@@ -9,8 +9,8 @@ __version__ = '3.0.1'
 
 logger = logging.getLogger(__name__)
 
-NORMAL, EXTRA, USER = range(3)
-category_names = ['Regular credit', 'Extra credit', 'Personal (not graded)']
+NORMAL, EXTRA, USER, PERF = range(4)
+category_names = ['Regular credit', 'Extra credit', 'Personal (not graded)', 'Performance']
 
 class Error(Exception):
     def report(self, ctx):
@@ -174,7 +174,12 @@ class Test:
             self.summary = 'unexpected return code: ' + str(p.returncode)
             self.check_for_sanitizer_output(p.pid, out)
 
+        return self.report(out)
 
+    def report(self, out):
+        """Print the outcome of a completed run and return (success, credit).
+        Failures are described by self.summary and self.comments.
+        """
         success = not self.summary
 
         reporter = get_reporter()
@@ -215,6 +220,11 @@ class Test:
             logger.debug('Moving to %r', self.dir)
             os.chdir(self.dir)
 
+    def describe(self):
+        """A short name for this test, for reports that list tests one per line.
+        """
+        return ' '.join(self.cmd[1:])
+
     def handle_stdin(self, proc_stdin):
         proc_stdin.close()
 
@@ -626,6 +636,10 @@ include $(SRCPATH)/Makefile
     def get_tests(self):
         return self.tests if self.ready else []
 
+    def gathered_tests(self):
+        "All gathered tests, whether or not the project has been built"
+        return self.tests or []
+
 
 
 class MultiProject:
@@ -673,6 +687,9 @@ class MultiProject:
     def get_tests(self):
         return itertools.chain.from_iterable(p.get_tests() for p in self.projects)
 
+    def gathered_tests(self):
+        return itertools.chain.from_iterable(p.gathered_tests() for p in self.projects)
+
 
 # --
 
@@ -769,6 +786,152 @@ def test_project(project, src_dir, build_dir, data_dir, fail_stop=False, request
             print(f'  {"":{group_width}} {cat_points:6.1f}        {cat_score:5.1f}')
 
 
+def mann_whitney_p(xs, ys):
+    """Two-sided p-value of the Mann-Whitney U test that xs and ys come from
+    the same distribution. Exact for small samples (counting the arrangements
+    that give each U), normal approximation otherwise.
+    """
+    n, m = len(xs), len(ys)
+    u = sum(1.0 if x > y else 0.5 if x == y else 0.0 for x in xs for y in ys)
+
+    if n * m <= 400:
+        # counts[i][j][k]: orderings of i x's and j y's with U = k
+        counts = [[None] * (m + 1) for _ in range(n + 1)]
+        for i in range(n + 1):
+            for j in range(m + 1):
+                if i == 0 or j == 0:
+                    counts[i][j] = [1]
+                    continue
+                # the largest element is an x (beating all j y's) or a y
+                a = [0] * j + counts[i-1][j]
+                b = counts[i][j-1]
+                counts[i][j] = [(a[k] if k < len(a) else 0) + (b[k] if k < len(b) else 0)
+                                for k in range(max(len(a), len(b)))]
+
+        dist = counts[n][m]
+        total = sum(dist)
+        tail = min(u, n * m - u)
+        p = 2 * sum(c for (k, c) in enumerate(dist) if k <= tail) / total
+        return min(p, 1.0)
+
+    import math
+    mean = n * m / 2
+    sd = math.sqrt(n * m * (n + m + 1) / 12)
+    z = (abs(u - mean) - 0.5) / sd
+    return min(1.0, math.erfc(max(z, 0) / math.sqrt(2)))
+
+def time_command(cmd, stdin_file, out_name, time_limit):
+    """Run cmd with its output in out_name. Returns (seconds, return code),
+    with a return code of None if it had to be killed.
+    """
+    stdin = open(stdin_file) if stdin_file else subprocess.DEVNULL
+    try:
+        with open(out_name, 'w') as out:
+            start = time.perf_counter()
+            try:
+                code = subprocess.run(cmd, stdin=stdin, stdout=out, stderr=subprocess.DEVNULL,
+                                      timeout=time_limit).returncode
+            except subprocess.TimeoutExpired:
+                code = None
+            return (time.perf_counter() - start, code)
+    finally:
+        if stdin_file:
+            stdin.close()
+
+def first_difference(name_a, name_b):
+    """Returns (line number of the first difference, lines differing), or None
+    if the files are identical.
+    """
+    first = None
+    differing = 0
+    with open(name_a, encoding='latin-1') as a, open(name_b, encoding='latin-1') as b:
+        for (i, (la, lb)) in enumerate(itertools.zip_longest(a, b), 1):
+            if la != lb:
+                differing += 1
+                if first is None:
+                    first = (i, la, lb)
+
+    return None if first is None else (first, differing)
+
+def compare_project(project, src_dir, build_dir, data_dir, binaries, repeat=5, requests=(),
+                    alpha=0.05, **kws):
+    """Time two builds of the program on the same tests. Runs alternate
+    between the binaries, so drift in machine load affects both alike, and
+    each test reports the ratio of median times, whether the difference is
+    significant, and whether the outputs differ.
+    """
+    reporter = get_reporter()
+
+    project.set_context(src_dir, build_dir, data_dir)
+    if project.gather_tests(requests) < 1:
+        reporter.message('No tests requested.')
+        return
+    project.prepare_build_dir()
+
+    binaries = [os.path.realpath(b) for b in binaries]
+    for b in binaries:
+        if not os.access(b, os.X_OK):
+            raise Error('not an executable: ' + repr(b))
+
+    print(f'A: {binaries[0]}')
+    print(f'B: {binaries[1]}')
+    print(f'{repeat} runs of each, interleaved')
+    print()
+
+    rows = []
+    differences = []
+    for t in project.gathered_tests():
+        t.summary = ''
+        t.comments = []
+        t.prepare()
+
+        name = f'{t.group} {t.describe()}'
+        reporter.set_status(f'Comparing {name}')
+        stdin_file = t.input_file if isinstance(t, InputFileStdinTest) else None
+        outs = ['ab.a.out', 'ab.b.out']
+        times = ([], [])
+        failed = False
+
+        for r in range(repeat):
+            # alternate which binary goes first, so neither always runs on a
+            # warm cache left by the other
+            order = (0, 1) if r % 2 == 0 else (1, 0)
+            for which in order:
+                cmd = [binaries[which]] + t.cmd[1:]
+                (elapsed, code) = time_command(cmd, stdin_file, outs[which], t.time_limit)
+                if code != t.ref_code:
+                    failed = True
+                times[which].append(elapsed)
+
+        diff = first_difference(*outs)
+        for o in outs:
+            os.remove(o)
+
+        ma = sorted(times[0])[len(times[0]) // 2]
+        mb = sorted(times[1])[len(times[1]) // 2]
+        p = mann_whitney_p(times[0], times[1])
+        rows.append((name, ma, mb, ma / mb if mb > 0 else float('inf'), p,
+                     ' failed' if failed else '', diff))
+        if diff:
+            differences.append((name, diff))
+
+    reporter.clear_bar()
+    width = max(4, max(len(r[0]) for r in rows))
+    print(f'{"test":{width}}  {"A median":>10} {"B median":>10} {"speedup":>8} {"p":>7}')
+    for (name, ma, mb, speedup, p, failed, diff) in rows:
+        mark = '*' if p < alpha else ' '
+        note = (' output differs' if diff else '') + failed
+        print(f'{name:{width}}  {ma:9.4f}s {mb:9.4f}s {speedup:7.2f}x {p:7.4f}{mark}{note}')
+
+    print()
+    print(f'speedup is A median / B median; * marks p < {alpha} (Mann-Whitney U)')
+
+    for (name, ((line, la, lb), count)) in differences:
+        print()
+        print(f'{name}: {count:,} lines differ, first at line {line:,}')
+        print('  A: ' + repr(la))
+        print('  B: ' + repr(lb))
+
 logcfg = {
     'version': 1,
     'disable_existing_loggers': False,
@@ -810,6 +973,10 @@ def get_args(src_subdir):
         help='Directory to place object files')
     argp.add_argument('-a', '--archive', metavar='tar',
         help='Archive containing program files (overrides -s and -o)')
+    argp.add_argument('-c', '--compare', nargs=2, metavar=('A', 'B'),
+        help='Time two builds of the program against each other instead of grading')
+    argp.add_argument('-n', '--repeat', type=int, default=5, metavar='N',
+        help='Runs of each binary per test when comparing (default 5)')
 #     argp.add_argument('-x', '--extra', action='store_true',
 #         help='Include extra credit tests')
 #     argp.add_argument('-m', '--multiply', nargs=2, metavar=('project','factor'),
@@ -887,6 +1054,12 @@ def main(name, assignment, release=1,
         'init_only': args.init,
     }
 
+    run_project = test_project
+    if args.compare:
+        run_project = compare_project
+        kws['binaries'] = args.compare
+        kws['repeat'] = max(1, args.repeat)
+
     try:
         reporter.clear_bar()
         print(f'{name} Auto-grader, Release {release}')
@@ -915,7 +1088,7 @@ def main(name, assignment, release=1,
                 src_dir   = os.path.realpath(src_subdir)
                 build_dir = os.path.realpath(build_subdir)
 
-                test_project(assignment, src_dir, build_dir, data_dir, **kws)
+                run_project(assignment, src_dir, build_dir, data_dir, **kws)
 
         else:
             src_dir = os.path.realpath(args.src)
@@ -935,7 +1108,7 @@ def main(name, assignment, release=1,
                 logger.info('Removing build_dir: %r', build_dir)
                 shutil.rmtree(build_dir)
 
-            test_project(assignment, src_dir, build_dir, data_dir, **kws)
+            run_project(assignment, src_dir, build_dir, data_dir, **kws)
 
     except Error as e:
         reporter.clear_bar()
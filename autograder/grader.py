@@ -1,7 +1,7 @@
 #!/usr/bin/env python3
 
 import autograde
-import os, os.path, shutil
+import os, os.path, sys, shutil, subprocess, threading, time, random, itertools, collections
 
 assignment_name = 'PA2'
 release = '2'
@@ -37,6 +37,9 @@ class MLTest(autograde.FileRefTest):
         self.comments += ['training file: ' + repr(self.train_file),
                           'data file:     ' + repr(self.data_file)]
 
+    def describe(self):
+        return os.path.basename(self.data_file)
+
 
 class MLTests(autograde.AbstractTestGroup):
     def get_tests(self, project, prog, build_dir, data_dir):
@@ -85,7 +88,184 @@ class MLTests(autograde.AbstractTestGroup):
                          dir        = build_dir)
 
 
-assignment = MLTests.Project('estimate', weight=5)
+# Performance tests run estimate on inputs generated on the fly. Each spec
+# names a shape, the seed that generates it, and the budgets it must meet:
+# wall-clock seconds and peak resident memory in MiB. The budgets allow for
+# the sanitizer build made by the Makefile.
+# runs > 1 repeats the whole process and budgets the total time; tiny inputs
+# are all start-up cost, so one run is too short to time. The sanitizer build
+# takes about 8 ms a run there, so 200 runs get 5 s: about three times that,
+# where a regression to tens of milliseconds a run fails
+PerfSpec = collections.namedtuple('PerfSpec',
+    'name attributes train_rows data_rows seed time_budget memory_budget runs',
+    defaults=(1,))
+
+perf_specs = [
+    PerfSpec('tall',  4, 1000000,   10000, 101, 30,  512),
+    PerfSpec('score', 4,   10000, 1000000, 102, 30,  128),
+    PerfSpec('wide', 64,   50000,   50000, 103, 30,  256),
+    PerfSpec('tiny',  2,       3,       3, 104,  5,   64, 200),
+    PerfSpec('small', 6,      10,      10, 105,  5,   64, 200),
+]
+
+def generate_perf_input(spec):
+    """Write perf.<name>.train, .data and .ref in the current directory, unless
+    they already exist. Attributes and weights are small integers and prices
+    are exact, so the fitted model reproduces the weights and every reference
+    price is an integer.
+    """
+    names = [f'perf.{spec.name}.{kind}' for kind in ('train', 'data', 'ref')]
+    if all(os.path.exists(n) for n in names):
+        return names
+
+    autograde.logger.info('Generating performance input %r', spec.name)
+    rng = random.Random(spec.seed)
+    weights = [rng.randint(-500, 500) for _ in range(spec.attributes + 1)]
+
+    def row():
+        x = [rng.randint(0, 100) for _ in range(spec.attributes)]
+        return x, weights[0] + sum(w * v for (w, v) in zip(weights[1:], x))
+
+    with open(names[0], 'w') as train:
+        train.write(f'train\n{spec.attributes}\n{spec.train_rows}\n')
+        for _ in range(spec.train_rows):
+            x, y = row()
+            train.write(' '.join('%f' % v for v in x + [y]) + '\n')
+
+    with open(names[1], 'w') as data, open(names[2], 'w') as ref:
+        data.write(f'data\n{spec.attributes}\n{spec.data_rows}\n')
+        for _ in range(spec.data_rows):
+            x, y = row()
+            data.write(' '.join('%f' % v for v in x) + '\n')
+            ref.write(f'{y}\n')
+
+    return names
+
+class PerfTest(autograde.Test):
+    """Run estimate on a generated input under time and memory budgets. The
+    output goes to a file rather than a pipe and is checked against the
+    reference afterwards, allowing one unit of rounding per price.
+    """
+    def __init__(self, spec, **kws):
+        super().__init__(**kws)
+        self.spec = spec
+        self.time_limit = spec.time_budget
+
+    def prepare(self):
+        super().prepare()
+        (self.train_file, self.data_file, self.ref_file) = generate_perf_input(self.spec)
+        self.cmd = self.cmd[:1] + [self.train_file, self.data_file]
+        self.comments += [f'input: {self.spec.train_rows:,} training rows, '
+                          f'{self.spec.data_rows:,} data rows, '
+                          f'{self.spec.attributes} attributes']
+
+    def describe(self):
+        return self.spec.name
+
+    def run(self):
+        logger = autograde.logger
+        logger.debug('Running %s: %s', self.group, self.spec)
+
+        self.summary = ''
+        self.comments = []
+
+        self.prepare()
+        out_name = f'perf.{self.spec.name}.out'
+        err_name = f'perf.{self.spec.name}.err'
+
+        # every run writes the same output; the last one is checked
+        elapsed = 0
+        peak = 0
+        for _ in range(self.spec.runs):
+            with open(out_name, 'w') as out, open(err_name, 'w+') as err:
+                start = time.monotonic()
+                p = subprocess.Popen(self.cmd, stdin=subprocess.DEVNULL, stdout=out, stderr=err)
+
+                def cancel():
+                    p.kill()
+                    self.summary = 'exceeded time budget'
+
+                timer = threading.Timer(self.time_limit - elapsed, cancel)
+                timer.start()
+                try:
+                    (_, status, usage) = os.wait4(p.pid, 0)
+                finally:
+                    timer.cancel()
+
+                elapsed += time.monotonic() - start
+                p.returncode = os.waitstatus_to_exitcode(status)
+                err.seek(0)
+                errors = err.read(self.output_limit)
+
+            # ru_maxrss is in KiB on Linux and bytes on macOS
+            peak = max(peak, usage.ru_maxrss / (1024 * 1024 if sys.platform == 'darwin' else 1024))
+            if self.summary or p.returncode != self.ref_code:
+                break
+
+        rows = (self.spec.train_rows + self.spec.data_rows) * self.spec.runs
+        size = (os.path.getsize(self.train_file) + os.path.getsize(self.data_file)) / (1024 * 1024)
+
+        if self.summary:
+            pass
+        elif p.returncode != self.ref_code:
+            self.summary = 'unexpected return code: ' + str(p.returncode)
+            self.check_for_sanitizer_output(p.pid, errors)
+        else:
+            self.check_output(out_name)
+            if not self.summary and peak > self.spec.memory_budget:
+                self.summary = 'exceeded memory budget'
+
+        self.comments += [f'time:   {elapsed:.2f} s (budget {self.spec.time_budget} s)',
+                          f'memory: {peak:.0f} MiB (budget {self.spec.memory_budget} MiB)']
+        if self.spec.runs > 1:
+            self.comments += [f'runs:   {self.spec.runs}, {elapsed / self.spec.runs * 1000:.2f} ms each']
+
+        reporter = autograde.get_reporter()
+        reporter.clear_bar()
+        if self.spec.runs > 1:
+            print(f'{self.group} {self.spec.name}: {elapsed:6.2f} s {self.spec.runs} runs, '
+                  f'{elapsed / self.spec.runs * 1000:.2f} ms per run {peak:6.0f} MiB peak')
+        else:
+            print(f'{self.group} {self.spec.name}: {elapsed:6.2f} s {rows / elapsed:12,.0f} rows/s '
+                  f'{size / elapsed:8.1f} MiB/s {peak:6.0f} MiB peak')
+
+        return self.report(errors)
+
+    def check_output(self, out_name):
+        with open(out_name) as out, open(self.ref_file) as ref:
+            for (i, (outl, refl)) in enumerate(itertools.zip_longest(out, ref), 1):
+                try:
+                    good = abs(float(outl) - float(refl)) <= 1
+                except (TypeError, ValueError):
+                    good = False
+
+                if not good:
+                    self.summary = 'incorrect output'
+                    self.comments += ['line {:,}'.format(i),
+                                      '  expected: ' + repr(refl),
+                                      '  received: ' + repr(outl)]
+                    return
+
+class PerfTests(autograde.AbstractTestGroup):
+    def __init__(self, specs=perf_specs, **kws):
+        kws.setdefault('id', 'perf')
+        kws.setdefault('category', autograde.PERF)
+        super().__init__(**kws)
+        self.specs = specs
+
+    def get_tests(self, project, prog, build_dir, data_dir):
+        test_group = f'{project}:{self.name}'
+
+        for spec in self.specs:
+            yield PerfTest(cmd      = ['./' + prog],
+                           spec     = spec,
+                           category = self.category,
+                           group    = test_group,
+                           weight   = self.weight,
+                           dir      = build_dir)
+
+
+assignment = autograde.Project('estimate', MLTests(weight=5), PerfTests(weight=1))
 
 if __name__ == '__main__':
     autograde.main(assignment_name, assignment, release)
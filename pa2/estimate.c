@@ -1,6 +1,150 @@
+#define _GNU_SOURCE
+
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/magic.h>
+
+// number of data rows parsed and scored together. Each block is pushed
+// through one matrix-matrix multiply against every model at once.
+#define BLOCK_ROWS 256
+
+// matrices of at least this many bytes are placed in an unlinked temporary
+// file instead of on the heap, so the kernel can page them out (the
+// out-of-core mode). 0 keeps everything on the heap. only set while
+// training, see spillThreshold().
+size_t spill_bytes = 0;
+
+// every matrix buffer starts with a small header recording how it was
+// allocated: 0 for the heap, otherwise the length of the file mapping.
+#define MATRIX_HEADER 16
+
+// the directory spilled matrices are placed in
+const char * spillDir(void) {
+
+  const char * dir = getenv("TMPDIR");
+
+  return dir != NULL ? dir : "/tmp";
+
+}
+
+// nonzero if spillDir() is itself in memory, where spilling frees nothing
+int spillInMemory(void) {
+
+  struct statfs fs;
+
+  return statfs(spillDir(), &fs) == 0 && fs.f_type == TMPFS_MAGIC;
+
+}
+
+// the out-of-core plan counts only the attributes x attributes matrices as
+// on disk (see estimateCosts()): X^T X, its inverse and the partial sums.
+// anything smaller, like X^T Y, the weights or a scoring block of a narrow
+// file, stays on the heap, so spilling is a handful of files, not one per
+// allocation.
+size_t spillThreshold(int attributes) {
+
+  size_t cols = (size_t) attributes + 1;
+
+  return MATRIX_HEADER + (cols * cols + 1) * sizeof(double);
+
+}
+
+void * spillBuffer(size_t bytes) {
+
+  char path[4096];
+  void * buffer;
+  int fd;
+
+  if (snprintf(path, sizeof(path), "%s/estimate.XXXXXX", spillDir()) >= (int) sizeof(path)) {
+    return NULL;
+  }
+  fd = mkstemp(path);
+  if (fd < 0) {
+    return NULL;
+  }
+  unlink(path);
+
+  if (ftruncate(fd, bytes) != 0) {
+    close(fd);
+    return NULL;
+  }
+  buffer = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  return buffer == MAP_FAILED ? NULL : buffer;
+
+}
+
+double ** allocMatrix(int rows, int cols) {
+
+  // one contiguous buffer with row pointers into it, so a block of rows can
+  // be streamed through multiply() without chasing a pointer per row.
+  int i;
+  size_t bytes = MATRIX_HEADER + ((size_t) rows * cols + 1) * sizeof(double);
+  double ** matrix = malloc((rows > 0 ? rows : 1) * sizeof(double *));
+  char * base = NULL;
+
+  if (spill_bytes > 0 && bytes >= spill_bytes) {
+    base = spillBuffer(bytes);
+  }
+  if (base != NULL) {
+    *(size_t *) base = bytes;
+  } else {
+    base = calloc(bytes, 1);
+  }
+
+  double * data = (double *) (base + MATRIX_HEADER);
+
+  matrix[0] = data;
+  for (i = 0; i < rows; i++) {
+    matrix[i] = data + (size_t) i * cols;
+  }
+
+  return matrix;
+
+}
+
+void freeMatrix(double ** matrix) {
+
+  if (matrix == NULL) {
+    return;
+  }
+
+  char * base = (char *) matrix[0] - MATRIX_HEADER;
+  size_t mapped = *(size_t *) base;
+
+  if (mapped) {
+    munmap(base, mapped);
+  } else {
+    free(base);
+  }
+  free(matrix);
+
+}
 
 double ** transpose(double ** matrix, double ** transpose, int rows, int cols){
   int i, j;
@@ -16,24 +160,63 @@ double ** transpose(double ** matrix, double ** transpose, int rows, int cols){
 }
 
 void printPriceMatrix(double ** matrix, int rows, int cols) {
-    
+
   int i, j;
   for (i = 0; i < rows; i++) {
     for (j = 0; j < cols; j++){
-      printf("%.0f", matrix[i][j]);  
+      if (j > 0) {
+        printf(" ");
+      }
+      printf("%.0f", matrix[i][j]);
     }
 	printf("\n");
   }
 }
 
-double ** inverse(double ** matrix, int rows, int cols) {
+// a growable run of output text, so threads can format their predictions
+// side by side and have them written out in order afterwards
+typedef struct {
+  char * data;
+  size_t len, size;
+} Buffer;
 
-    int p , i, j;
-    double ** identity_matrix = (double **)malloc(rows * sizeof(double *));
-    for (i = 0; i < rows; i++) {
-        identity_matrix[i] = malloc(rows * sizeof(double));
+// makes room for len more bytes at the end and returns where they go
+char * reserveBuffer(Buffer * buffer, size_t len) {
+
+  if (buffer->len + len > buffer->size) {
+    buffer->size = buffer->size * 2 > buffer->len + len ? buffer->size * 2 : buffer->len + len;
+    buffer->data = realloc(buffer->data, buffer->size);
+  }
+  buffer->len += len;
+
+  return buffer->data + buffer->len - len;
+
+}
+
+void appendBuffer(Buffer * buffer, const char * text, size_t len) {
+  memcpy(reserveBuffer(buffer, len), text, len);
+}
+
+// same format as printPriceMatrix
+void appendPrices(Buffer * buffer, double ** matrix, int rows, int cols) {
+
+  char text[64];
+  int i, j, n;
+  for (i = 0; i < rows; i++) {
+    for (j = 0; j < cols; j++) {
+      n = snprintf(text, sizeof(text), j > 0 ? " %.0f" : "%.0f", matrix[i][j]);
+      appendBuffer(buffer, text, n);
     }
-    
+    appendBuffer(buffer, "\n", 1);
+  }
+
+}
+
+// inverts matrix into identity_matrix, which the caller provides
+double ** inverseInto(double ** matrix, double ** identity_matrix, int rows, int cols) {
+
+    int p , i, j;
+
     for (i = 0; i < rows; i++) {
         for (j = 0; j < cols; j++) {
             if (i == j) {
@@ -68,7 +251,7 @@ double ** inverse(double ** matrix, int rows, int cols) {
 	    f = matrix[i][p];
             for (ct = 0; ct < rows; ct++) {
                 matrix[i][ct] -= (f * matrix[p][ct]);
-                identity_matrix[i][ct] -= (f * identity_matrix[p][ct]); 
+                identity_matrix[i][ct] -= (f * identity_matrix[p][ct]);
             }
         }
     }
@@ -77,19 +260,27 @@ double ** inverse(double ** matrix, int rows, int cols) {
 
 }
 
+double ** inverse(double ** matrix, int rows, int cols) {
+    return inverseInto(matrix, allocMatrix(rows, rows), rows, cols);
+}
+
 
 double ** multiply(double ** matrix1, double ** matrix2, double ** result, int rows, int cols, int cols1) {
 
   int i, j, k;
 
+  // i-k-j order: the inner loop walks a row of matrix2 and a row of result,
+  // so a wide right-hand side (many models) vectorizes. every result[i][j]
+  // still sums over k in ascending order, same as the textbook i-j-k loop.
   for (i = 0; i < rows; i++) {
-    for (j = 0; j < cols; j++) {
-      for (k = 0; k < cols1; k++) {
-	 result[i][j] += matrix1[i][k] * matrix2[k][j];
+    for (k = 0; k < cols1; k++) {
+      double f = matrix1[i][k];
+      for (j = 0; j < cols; j++) {
+	 result[i][j] += f * matrix2[k][j];
       }
     }
   }
-  
+
   return result;
 
 }
@@ -107,7 +298,7 @@ void printMatrix(double ** matrix, int rows, int cols) {
 }
 
 double ** insertZeroes(double ** matrix, int rows, int cols) {
-  
+
   int i, j;
   for (i = 0; i < rows; i++) {
     for (j = 0; j < cols; j++) {
@@ -119,143 +310,6646 @@ double ** insertZeroes(double ** matrix, int rows, int cols) {
 
 }
 
-int main(int argc, char ** argv) {
-    FILE *file1;
-    file1 = fopen(argv[1], "r");
+// ----- CHOLESKY ----------
+//
+// X^T X is symmetric positive definite whenever the attributes are
+// independent, so it can be factored as L L^T with L lower triangular. the
+// factor can be solved against in O(n^2), and updated or downdated by one row
+// of X in O(n^2) as well, which is what the windowed mode relies on.
 
-    int i, j, num_of_attributes, num_of_houses;
+// factors matrix into lower (whose upper triangle is left alone). returns 0,
+// or -1 if matrix isn't numerically positive definite.
+int cholesky(double ** matrix, double ** lower, int n) {
 
-    char *train = malloc(7*sizeof(char));
-    strcpy(train, "");
-    fscanf(file1, " %s", train);
-    fscanf(file1, " %d", &num_of_attributes);
-    fscanf(file1, " %d", &num_of_houses);
-   
+  int i, j, k;
 
-    double ** matrix_x = malloc( num_of_houses * sizeof(double *));
-    double ** vector_y = malloc( num_of_houses * sizeof(double *));
-    double ** vector_w = malloc( (num_of_attributes + 1) * sizeof(double*));
+  for (j = 0; j < n; j++) {
+    double d = matrix[j][j];
+    for (k = 0; k < j; k++) {
+      d -= lower[j][k] * lower[j][k];
+    }
+    if (!(d > 0)) {
+      return -1;
+    }
+    lower[j][j] = sqrt(d);
 
-    for (i = 0; i < num_of_houses; i++) {
-        matrix_x[i] = malloc((num_of_attributes + 1) * sizeof(double));
-	vector_y[i] = malloc(sizeof(double));
+    for (i = j + 1; i < n; i++) {
+      double f = matrix[i][j];
+      for (k = 0; k < j; k++) {
+        f -= lower[i][k] * lower[j][k];
+      }
+      lower[i][j] = f / lower[j][j];
+    }
+  }
+
+  return 0;
+
+}
+
+// solves L L^T x = b, overwriting b with x. a 0 on the diagonal marks a
+// column left out of the model (see choleskyIndependent()), whose x is 0.
+void choleskySolve(double ** lower, double * b, int n) {
+
+  int i, k;
+
+  for (i = 0; i < n; i++) {
+    for (k = 0; k < i; k++) {
+      b[i] -= lower[i][k] * b[k];
+    }
+    b[i] = lower[i][i] != 0 ? b[i] / lower[i][i] : 0;
+  }
+  for (i = n - 1; i >= 0; i--) {
+    for (k = i + 1; k < n; k++) {
+      b[i] -= lower[k][i] * b[k];
     }
+    b[i] = lower[i][i] != 0 ? b[i] / lower[i][i] : 0;
+  }
+
+}
 
-    for (i = 0; i < num_of_attributes + 1; i++) {
-      vector_w[i] = malloc(sizeof(double));
+// turns the factor of G into the factor of G + x x^T (sign 1) or G - x x^T
+// (sign -1) with a sweep of plane rotations. x is used as scratch. returns
+// 0, or -1 if a downdate would leave G indefinite, in which case lower is no
+// longer usable and has to be refactored.
+int choleskyRankOne(double ** lower, double * x, int n, int sign) {
+
+  int i, k;
+
+  for (k = 0; k < n; k++) {
+    double l = lower[k][k];
+    double r2 = l * l + sign * x[k] * x[k];
+    if (!(r2 > 0)) {
+      return -1;
     }
+    double r = sqrt(r2);
+    double c = r / l, s = x[k] / l;
+    lower[k][k] = r;
+    for (i = k + 1; i < n; i++) {
+      lower[i][k] = (lower[i][k] + sign * s * x[i]) / c;
+      x[i] = c * x[i] - s * lower[i][k];
+    }
+  }
 
-    matrix_x = insertZeroes(matrix_x, num_of_houses, num_of_attributes + 1);
-    vector_y = insertZeroes(vector_y, num_of_houses, 1);
-    vector_w = insertZeroes(vector_w, num_of_attributes + 1, 1);
+  return 0;
 
-    // loops through the given data points, the fscanf inside the for loop is 
-    // to input numbers into X, accounting for the 0th column of 1s. Should
-    // loop only four times, leaving the next scan for Y, which will occur outside
-    // the nested for loop, but inside the parent for loop. 
+}
 
+// many small systems (one per group, say) are better solved together than
+// one after another: laid out so that lane l of every element sits side by
+// side with the other lanes, each step of the factorization becomes a loop
+// over BATCH_LANES independent values, which the compiler turns into SIMD.
 
-    for (i = 0; i < num_of_houses; i++) {
-        matrix_x[i][0] = 1;
-        for (j = 1; j < num_of_attributes + 1; j++) {
-            fscanf(file1, "%lf", &matrix_x[i][j]);
+#define BATCH_LANES 8
+
+// a pivot that has lost all but this much of its diagonal entry is taken to
+// be rounding error: the columns are dependent
+#define PIVOT_TOLERANCE 1e-12
+
+// index of (i, j), j >= i, in the upper triangle of an n x n matrix packed by rows
+#define PACKED(i, j, n) ((i) * (n) - (i) * ((i) - 1) / 2 + (j) - (i))
+
+// factors and solves BATCH_LANES systems of size n at once. element e of
+// lane l is at [e * BATCH_LANES + l], where upper holds each matrix's upper
+// triangle packed by rows and rhs each right-hand side. upper is overwritten
+// with U, where the matrix is U^T U, and rhs with the solutions. lanes that
+// aren't positive definite have ok cleared, and their results are garbage.
+void choleskyBatch(double * upper, double * rhs, int n, int * ok) {
+
+  int i, j, k, l;
+  double least[BATCH_LANES];
+
+  for (i = 0; i < n; i++) {
+    double * d = &upper[PACKED(i, i, n) * BATCH_LANES];
+    for (l = 0; l < BATCH_LANES; l++) {
+      least[l] = d[l] * PIVOT_TOLERANCE;
+    }
+    for (k = 0; k < i; k++) {
+      double * u = &upper[PACKED(k, i, n) * BATCH_LANES];
+      for (l = 0; l < BATCH_LANES; l++) {
+        d[l] -= u[l] * u[l];
+      }
+    }
+    // a failed lane carries on with 1 so the others aren't held up
+    for (l = 0; l < BATCH_LANES; l++) {
+      int good = d[l] > least[l] && d[l] > 0;
+      ok[l] &= good;
+      d[l] = sqrt(good ? d[l] : 1);
+    }
+
+    for (j = i + 1; j < n; j++) {
+      double * e = &upper[PACKED(i, j, n) * BATCH_LANES];
+      for (k = 0; k < i; k++) {
+        double * u = &upper[PACKED(k, i, n) * BATCH_LANES];
+        double * v = &upper[PACKED(k, j, n) * BATCH_LANES];
+        for (l = 0; l < BATCH_LANES; l++) {
+          e[l] -= u[l] * v[l];
         }
-        fscanf(file1, "%lf", &vector_y[i][0]);
+      }
+      for (l = 0; l < BATCH_LANES; l++) {
+        e[l] /= d[l];
+      }
+    }
+  }
+
+  // U^T z = rhs, then U x = z
+  for (i = 0; i < n; i++) {
+    double * x = &rhs[i * BATCH_LANES];
+    for (k = 0; k < i; k++) {
+      double * u = &upper[PACKED(k, i, n) * BATCH_LANES];
+      for (l = 0; l < BATCH_LANES; l++) {
+        x[l] -= u[l] * rhs[k * BATCH_LANES + l];
+      }
+    }
+    for (l = 0; l < BATCH_LANES; l++) {
+      x[l] /= upper[PACKED(i, i, n) * BATCH_LANES + l];
+    }
+  }
+  for (i = n - 1; i >= 0; i--) {
+    double * x = &rhs[i * BATCH_LANES];
+    for (j = i + 1; j < n; j++) {
+      double * u = &upper[PACKED(i, j, n) * BATCH_LANES];
+      for (l = 0; l < BATCH_LANES; l++) {
+        x[l] -= u[l] * rhs[j * BATCH_LANES + l];
+      }
+    }
+    for (l = 0; l < BATCH_LANES; l++) {
+      x[l] /= upper[PACKED(i, i, n) * BATCH_LANES + l];
+    }
+  }
+
+}
+
+// duplicated or dependent attributes make X^T X singular, and inverse()
+// would divide by (nearly) zero. before inverting, X^T X is factored with
+// diagonal pivoting, which picks the same columns as QR with column
+// pivoting on X would, without needing X: each step takes the column least
+// explained by those already taken, and the factorization stops once no
+// column has more than RANK_TOLERANCE of itself left. X^T X is first scaled
+// to a unit diagonal so attributes measured in large units aren't favoured.
+// the columns left over are dropped from the solve and get weight 0.
+
+// a column whose part not explained by the others is under 1e-5 of its
+// length (squared here, as X^T X holds squares) can't be told apart from
+// one that is dependent but was rounded when the data was written out
+#define RANK_TOLERANCE 1e-10
+
+// sets kept[j] to whether column j of the symmetric n x n gram is among a
+// largest set of numerically independent columns, preferring earlier ones
+// on ties. work is n x n scratch. returns the number of columns kept.
+int independentColumns(double ** gram, int n, int * kept, double ** work) {
+
+  int i, j, p, rank = 0;
+
+  for (i = 0; i < n; i++) {
+    kept[i] = 0;
+    for (j = 0; j < n; j++) {
+      double d = gram[i][i] * gram[j][j];
+      work[i][j] = d > 0 ? gram[i][j] / sqrt(d) : 0;
     }
+  }
 
-    double ** transpose_x = malloc((num_of_attributes+1) * sizeof(double *));
+  for (;;) {
+    for (p = -1, i = 0; i < n; i++) {
+      if (!kept[i] && (p < 0 || work[i][i] > work[p][p])) {
+        p = i;
+      }
+    }
+    if (p < 0 || !(work[p][p] > RANK_TOLERANCE)) {
+      break;
+    }
+    kept[p] = 1;
+    rank++;
 
-    for (i = 0; i < num_of_attributes + 1; i++) {
-      transpose_x[i] = malloc(num_of_houses * sizeof(double));
+    // what's left of every other column once column p is taken out
+    double r = sqrt(work[p][p]);
+    for (i = 0; i < n; i++) {
+      work[i][p] = kept[i] ? 0 : work[i][p] / r;
     }
+    for (i = 0; i < n; i++) {
+      for (j = 0; j < n && !kept[i]; j++) {
+        work[i][j] -= kept[j] ? 0 : work[i][p] * work[j][p];
+      }
+    }
+  }
+
+  return rank;
 
-    transpose_x = insertZeroes(transpose_x, num_of_attributes + 1, num_of_houses);
+}
 
-    transpose_x = transpose(matrix_x, transpose_x,num_of_houses, num_of_attributes+1);
+// reports the columns independentColumns() left out of the model fitted
+// from path
+void reportDependent(const char * path, const int * kept, int cols) {
 
-   
+  int j;
 
-    double ** product_x = malloc((num_of_attributes + 1)*sizeof(double *));
-    for (i = 0; i < num_of_attributes+1; i++) {
-      product_x[i] = malloc((num_of_attributes + 1) * sizeof(double));
+  for (j = 0; j < cols; j++) {
+    if (!kept[j] && j == 0) {
+      fprintf(stderr, "%s: the constant term is dependent on the attributes, left out\n", path);
+    } else if (!kept[j]) {
+      fprintf(stderr, "%s: attribute %d is dependent on the others, left out\n", path, j);
     }
+  }
+
+}
 
-    product_x = insertZeroes(product_x, num_of_attributes + 1, num_of_attributes + 1);
+// the inverse of the Gram matrix X^T X (cols x cols, symmetric). when some
+// columns are dependent on the others, they are reported and the inverse is
+// of X^T X without them, with their rows and columns 0. gram is used up.
+double ** inverseIndependent(double ** gram, int cols, const char * path) {
 
-    product_x = multiply(transpose_x, matrix_x, product_x, num_of_attributes + 1, num_of_attributes + 1, num_of_houses);
+  int i, j, a, c, rank;
+  int * kept = malloc(cols * sizeof(int));
+  double ** work = allocMatrix(cols, cols);
 
-   
+  rank = independentColumns(gram, cols, kept, work);
+  freeMatrix(work);
+  if (rank == cols) {
+    free(kept);
+    return inverse(gram, cols, cols);
+  }
+
+  reportDependent(path, kept, cols);
 
-    
-    double ** inverse_x = malloc((num_of_attributes + 1) * sizeof(double *));
-    for (i = 0; i < num_of_attributes+1; i++) {
-      inverse_x[i] = malloc((num_of_attributes + 1) * sizeof(double));
+  double ** reduced = allocMatrix(rank, rank);
+  double ** result = allocMatrix(cols, cols);
+
+  for (a = 0, i = 0; i < cols; i++) {
+    for (c = 0, j = 0; j < cols && kept[i]; j++) {
+      if (kept[j]) {
+        reduced[a][c++] = gram[i][j];
+      }
     }
+    a += kept[i];
+  }
 
-    inverse_x = insertZeroes(inverse_x, num_of_attributes + 1, num_of_attributes + 1);
+  double ** inverse_x = inverse(reduced, rank, rank);
 
-    inverse_x = inverse(product_x, num_of_attributes + 1, num_of_attributes + 1);
+  for (a = 0, i = 0; i < cols; i++) {
+    for (c = 0, j = 0; j < cols && kept[i]; j++) {
+      if (kept[j]) {
+        result[i][j] = inverse_x[a][c++];
+      }
+    }
+    a += kept[i];
+  }
 
-    
-   
-    double ** result_x = malloc((num_of_attributes + 1) * sizeof(double *));
-    for (i = 0; i < num_of_attributes + 1; i++) {
-        result_x[i] = malloc(num_of_houses * sizeof(double));
-    } 
+  freeMatrix(reduced);
+  freeMatrix(inverse_x);
+  free(kept);
 
-    result_x = insertZeroes(result_x, num_of_attributes + 1, num_of_houses);
+  return result;
 
-    result_x = multiply(inverse_x, transpose_x, result_x, num_of_attributes + 1,num_of_houses, num_of_attributes + 1);
+}
 
-    vector_w = multiply(result_x, vector_y, vector_w, num_of_attributes + 1, 1, num_of_houses);
+// cholesky() of the Gram matrix X^T X (cols x cols, symmetric, left alone)
+// over just the columns independentColumns() keeps: the rows and columns of
+// the others are 0 in lower, so choleskySolve() gives them weight 0 and
+// intervalBounds() no leverage. the dropped columns are reported if path
+// isn't NULL. returns the number of columns kept, or -1 if even they can't
+// be factored.
+int choleskyIndependent(double ** gram, double ** lower, int cols, const char * path) {
 
-    fclose(file1);
+  int i, j, a, c, rank;
+  int * kept = malloc(cols * sizeof(int));
+  double ** work = allocMatrix(cols, cols);
 
-    // ----- SHOULD BE DONE WITH TRAINING DATA SET ----------
+  rank = independentColumns(gram, cols, kept, work);
+  if (path != NULL) {
+    reportDependent(path, kept, cols);
+  }
 
-    FILE * file2;
-    file2 = fopen(argv[2], "r");
+  double ** reduced = allocMatrix(rank, rank);
+
+  for (a = 0, i = 0; i < cols; i++) {
+    for (c = 0, j = 0; j < cols && kept[i]; j++) {
+      if (kept[j]) {
+        work[a][c++] = gram[i][j];
+      }
+    }
+    a += kept[i];
+  }
+
+  if (cholesky(work, reduced, rank) != 0) {
+    rank = -1;
+  } else {
+    for (a = 0, i = 0; i < cols; i++) {
+      for (c = 0, j = 0; j < cols; j++) {
+        lower[i][j] = kept[i] && kept[j] ? reduced[a][c] : 0;
+        c += kept[j];
+      }
+      a += kept[i];
+    }
+  }
 
-    i = 0, j = 0;
-    int num_of_attributes_2 = 0, num_of_houses_2;
+  freeMatrix(work);
+  freeMatrix(reduced);
+  free(kept);
 
-    char *data = malloc(7 * sizeof(char));
-    fscanf(file2, " %s", data);
-    fscanf(file2, " %d", &num_of_attributes_2);
-    fscanf(file2, " %d", &num_of_houses_2);
+  return rank;
 
-    if (num_of_attributes != num_of_attributes_2) {
-      printf("error\n");
-      return 0;
+}
+
+// ----- INPUT PARSING ----------
+//
+// the input files are read through a line-buffered Reader rather than
+// fscanf, so every row can be checked as it is parsed: each line must hold
+// exactly the expected number of values, every value must be a well-formed
+// finite number, and the number of rows must match the header. problems are
+// reported as path:line and the caller gives up on the file.
+
+#define READ_CHUNK 65536
+
+// a Reader can also be confined to part of a file (see seekReader), so that
+// several threads can parse one file side by side. offset is the file offset
+// of buf[0]; lines starting at or after limit belong to someone else.
+typedef struct {
+  FILE * file;
+  const char * path;
+  char * buf;
+  size_t size, pos, len;
+  long line;
+  long long offset, limit, origin;
+} Reader;
+
+void initReader(Reader * reader, FILE * file, const char * path) {
+  reader->file = file;
+  reader->path = path;
+  reader->size = READ_CHUNK;
+  reader->buf = malloc(reader->size);
+  reader->pos = 0;
+  reader->len = 0;
+  reader->line = 0;
+  reader->offset = 0;
+  reader->limit = -1;
+  reader->origin = 0;
+}
+
+// a Reader over a file already in memory, which it doesn't own
+void initMemoryReader(Reader * reader, char * buf, size_t len, const char * path) {
+  reader->file = NULL;
+  reader->path = path;
+  reader->buf = buf;
+  reader->size = len;
+  reader->pos = 0;
+  reader->len = len;
+  reader->line = 0;
+  reader->offset = 0;
+  reader->limit = -1;
+  reader->origin = 0;
+}
+
+void freeReader(Reader * reader) {
+  if (reader->file != NULL) {
+    free(reader->buf);
+  }
+  reader->buf = NULL;
+}
+
+// moves the reader to the first line starting at or after start, and stops it
+// before the first line starting at or after limit (-1 for the end of file).
+// returns 0, or -1 if the file can't be positioned.
+int seekReader(Reader * reader, long long start, long long limit) {
+
+  int c = '\n';
+
+  if (start > 0) {
+    if (fseeko(reader->file, start - 1, SEEK_SET) != 0) {
+      return -1;
+    }
+    // start is a line start exactly when the byte before it is a newline
+    for (c = getc(reader->file), start--; c != EOF; c = getc(reader->file)) {
+      start++;
+      if (c == '\n') {
+        break;
+      }
+    }
+  } else {
+    rewind(reader->file);
+  }
+
+  reader->pos = 0;
+  reader->len = 0;
+  reader->line = 0;
+  reader->offset = start;
+  reader->origin = start;
+  reader->limit = limit;
+
+  return 0;
+
+}
+
+// file offset of the next unread line
+long long readerOffset(Reader * reader) {
+  return reader->offset + (long long) reader->pos;
+}
+
+// the number of lines that end before offset in path
+long linesBefore(const char * path, long long offset) {
+
+  FILE * file = fopen(path, "r");
+  long long left = offset;
+  long lines = 0;
+  char chunk[READ_CHUNK];
+
+  while (file != NULL && left > 0) {
+    size_t n = fread(chunk, 1, left < READ_CHUNK ? (size_t) left : READ_CHUNK, file);
+    char * p = chunk;
+    if (n == 0) {
+      break;
     }
+    left -= n;
+    while ((p = memchr(p, '\n', chunk + n - p)) != NULL) {
+      lines++;
+      p++;
+    }
+  }
+  if (file != NULL) {
+    fclose(file);
+  }
+
+  return lines;
+
+}
+
+void parseError(Reader * reader, const char * msg) {
+
+  long line = reader->line;
+
+  // a reader that started mid-file only knows lines relative to its start
+  if (reader->origin > 0) {
+    line += linesBefore(reader->path, reader->origin);
+  }
 
-    
+  fprintf(stderr, "%s:%ld: %s\n", reader->path, line, msg);
 
-    double ** estimator_x = malloc(num_of_houses_2 * sizeof(double *));
-    double ** estimator_y = malloc(num_of_houses_2 * sizeof(double *));
+}
+
+// returns the next line (without its newline) and sets *end, or NULL once the
+// file is exhausted. the line stays valid until the next call.
+char * nextLine(Reader * reader, char ** end) {
+
+  for (;;) {
+    char * start = reader->buf + reader->pos;
+
+    if (reader->limit >= 0 && readerOffset(reader) >= reader->limit) {
+      return NULL;
+    }
+
+    char * newline = memchr(start, '\n', reader->len - reader->pos);
 
-    for (i = 0; i < num_of_houses_2; i++) {
-      estimator_x[i] = malloc((num_of_attributes_2 + 1) * sizeof(double));
-      estimator_y[i] = malloc(sizeof(double));
+    if (newline != NULL) {
+      reader->pos = newline + 1 - reader->buf;
+      reader->line++;
+      *end = newline;
+      return start;
     }
 
-    estimator_x = insertZeroes(estimator_x, num_of_houses_2, num_of_attributes_2 + 1);
-    estimator_y = insertZeroes(estimator_y, num_of_houses_2, 1);
-    
-    for (i = 0; i < num_of_houses_2; i++) {
-      estimator_x[i][0] = 1;
-      for (j = 1; j < num_of_attributes_2 + 1; j++) {
-	fscanf(file2, "%lf", &estimator_x[i][j]);
+    if (reader->file == NULL || feof(reader->file) || ferror(reader->file)) {
+      if (reader->pos == reader->len) {
+        return NULL;
       }
+      // last line without a trailing newline
+      reader->pos = reader->len;
+      reader->line++;
+      *end = reader->buf + reader->len;
+      return start;
+    }
+
+    // keep the partial line, then top the buffer up behind it
+    memmove(reader->buf, start, reader->len - reader->pos);
+    reader->offset += reader->pos;
+    reader->len -= reader->pos;
+    reader->pos = 0;
+    if (reader->len == reader->size) {
+      reader->size *= 2;
+      reader->buf = realloc(reader->buf, reader->size);
     }
-    
+    reader->len += fread(reader->buf + reader->len, 1, reader->size - reader->len, reader->file);
+  }
 
-    estimator_y = multiply(estimator_x, vector_w, estimator_y, num_of_houses_2, 1, num_of_attributes_2+1);
+}
 
-    printPriceMatrix(estimator_y, num_of_houses_2, 1);
+int isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
 
-    fclose(file2);
-	
-    return 0;
+// powers of ten that are exact in a double. m * 10^e (or m / 10^e) with
+// m < 2^53 and |e| <= 22 is then correctly rounded, which is what strtod
+// would give; anything else takes the strtod path.
+static const double exact_powers[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// parses one number starting at p. returns the end of the token, or NULL if
+// it isn't a number. the caller checks what follows the token.
+char * parseNumber(char * p, char * end, double * value) {
+
+  char * start = p;
+  unsigned long long mantissa = 0;
+  int digits = 0, exponent = 0, any = 0, negative = 0;
+
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  for (; p < end && *p >= '0' && *p <= '9'; p++, any = 1) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += mantissa != 0;
+    } else {
+      exponent++;
+      digits++;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = 1) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa != 0;
+        exponent--;
+      } else {
+        digits++;
+      }
+    }
+  }
+  if (any && p < end && (*p == 'e' || *p == 'E')) {
+    char * q = p + 1;
+    int sign = 1, e = 0;
+    if (q < end && (*q == '-' || *q == '+')) {
+      sign = *q == '-' ? -1 : 1;
+      q++;
+    }
+    if (q < end && *q >= '0' && *q <= '9') {
+      for (; q < end && *q >= '0' && *q <= '9'; q++) {
+        if (e < 10000) {
+          e = e * 10 + (*q - '0');
+        }
+      }
+      exponent += sign * e;
+      p = q;
+    }
+  }
+
+  if (any && digits <= 19 && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+    double v = (double) mantissa;
+    v = exponent < 0 ? v / exact_powers[-exponent] : v * exact_powers[exponent];
+    *value = negative ? -v : v;
+    return p;
+  }
+
+  // long mantissas, big exponents and spelled-out values like "nan" or "inf".
+  // the token also ends at JSON's separators, for parseJsonNumber()
+  char token[64];
+  char * tail;
+  size_t n;
+  for (p = start; p < end && !isBlank(*p) && *p != ',' && *p != ']'; p++);
+  n = p - start;
+  if (n == 0 || n >= sizeof(token)) {
+    return NULL;
+  }
+  memcpy(token, start, n);
+  token[n] = '\0';
+  *value = strtod(token, &tail);
+  return tail == token ? NULL : start + (tail - token);
+
+}
+
+// nonzero if any value is NaN or +-Inf. tests the exponent bits directly so
+// the loop has no branches and vectorizes.
+int hasNonFinite(const double * values, int count) {
+
+  const unsigned long long exponent_bits = 0x7ff0000000000000ULL;
+  unsigned long long bits;
+  int i, bad = 0;
+
+  for (i = 0; i < count; i++) {
+    memcpy(&bits, &values[i], sizeof(bits));
+    bad |= (bits & exponent_bits) == exponent_bits;
+  }
+
+  return bad;
+
+}
+
+// reads the three header tokens: the file kind, number of attributes and
+// number of rows. returns 0 on success.
+int readHeader(Reader * reader, char * kind, size_t kind_size, int * attributes, int * houses) {
+
+  char * p;
+  char * end;
+  int found = 0;
+  long values[2];
+
+  while (found < 3 && (p = nextLine(reader, &end)) != NULL) {
+    for (;;) {
+      char * token;
+      for (; p < end && isBlank(*p); p++);
+      if (p == end) {
+        break;
+      }
+      for (token = p; p < end && !isBlank(*p); p++);
+
+      if (found == 3) {
+        parseError(reader, "unexpected data after the header");
+        return -1;
+      }
+      if (found == 0) {
+        size_t n = (size_t) (p - token) < kind_size - 1 ? (size_t) (p - token) : kind_size - 1;
+        memcpy(kind, token, n);
+        kind[n] = '\0';
+      } else {
+        char * tail;
+        char saved = *p;
+        *p = '\0';
+        values[found - 1] = strtol(token, &tail, 10);
+        *p = saved;
+        if (tail != p || values[found - 1] < 0 || values[found - 1] > 0x7fffffffL) {
+          parseError(reader, "header counts must be non-negative integers");
+          return -1;
+        }
+      }
+      found++;
+    }
+  }
+
+  if (found < 3) {
+    parseError(reader, "incomplete header");
+    return -1;
+  }
+
+  *attributes = (int) values[0];
+  *houses = (int) values[1];
+  return 0;
+
+}
+
+// finds the next non-blank line and points p past its leading blanks.
+// returns 1, or 0 at the end of the file.
+int nextRowLine(Reader * reader, char ** p, char ** end) {
+
+  do {
+    *p = nextLine(reader, end);
+    if (*p == NULL) {
+      return 0;
+    }
+    for (; *p < *end && isBlank(**p); (*p)++);
+  } while (*p == *end);
+
+  return 1;
+
+}
+
+// parses the rest of a line into exactly count values. returns 1, or -1 on a
+// malformed row.
+int parseValues(Reader * reader, char * p, char * end, double * row, int count) {
+
+  char msg[96];
+  int i;
+
+  for (i = 0; i < count; i++) {
+    for (; p < end && isBlank(*p); p++);
+    if (p == end) {
+      snprintf(msg, sizeof(msg), "expected %d values, found %d", count, i);
+      parseError(reader, msg);
+      return -1;
+    }
+    p = parseNumber(p, end, &row[i]);
+    if (p == NULL || (p < end && !isBlank(*p))) {
+      snprintf(msg, sizeof(msg), "value %d is not a number", i + 1);
+      parseError(reader, msg);
+      return -1;
+    }
+  }
+
+  for (; p < end && isBlank(*p); p++);
+  if (p != end) {
+    snprintf(msg, sizeof(msg), "expected %d values, found more", count);
+    parseError(reader, msg);
+    return -1;
+  }
+
+  if (hasNonFinite(row, count)) {
+    parseError(reader, "value is NaN or infinite");
+    return -1;
+  }
+
+  return 1;
+
+}
+
+// parses the next non-blank line into exactly count values. returns 1 when a
+// row was read, 0 at the end of the file and -1 on a malformed row.
+int readRow(Reader * reader, double * row, int count) {
+
+  char * p;
+  char * end;
+
+  if (!nextRowLine(reader, &p, &end)) {
+    return 0;
+  }
+
+  return parseValues(reader, p, end, row, count);
+
+}
+
+// like readRow, for rows that start with a key: any token that isn't blank.
+// *key points into the reader's buffer and is good until the next read.
+int readKeyedRow(Reader * reader, char ** key, size_t * key_len, double * row, int count) {
+
+  char * p;
+  char * end;
+
+  if (!nextRowLine(reader, &p, &end)) {
+    return 0;
+  }
+
+  for (*key = p; p < end && !isBlank(*p); p++);
+  *key_len = p - *key;
+
+  return parseValues(reader, p, end, row, count);
+
+}
+
+// reads count rows, reporting a short file the same way as a bad row.
+int readRows(Reader * reader, double * row, int count, int done, int total) {
+
+  char msg[96];
+  int status = readRow(reader, row, count);
+
+  if (status == 0) {
+    snprintf(msg, sizeof(msg), "header promises %d rows, file has %d", total, done);
+    parseError(reader, msg);
+    return -1;
+  }
+
+  return status;
+
+}
+
+// after the last promised row only blank lines may follow.
+int readEnd(Reader * reader, int total) {
+
+  char * p;
+  char * end;
+  char msg[96];
+
+  while ((p = nextLine(reader, &end)) != NULL) {
+    for (; p < end && isBlank(*p); p++);
+    if (p != end) {
+      snprintf(msg, sizeof(msg), "header promises %d rows, file has more", total);
+      parseError(reader, msg);
+      return -1;
+    }
+  }
+
+  return 0;
+
+}
+
+// ways of holding the training rows while fitting. see estimateCosts().
+#define MODE_AUTO      0
+#define MODE_INCORE    1
+#define MODE_STREAMING 2
+#define MODE_OOC       3
+
+static const char * mode_names[] = { "auto", "in-core", "streaming", "out-of-core" };
+
+// ----- COLUMN STORAGE ----------
+//
+// a training file held in memory is kept a column at a time, each column in
+// the narrowest type that holds every value in it exactly: bedrooms and
+// bathrooms fit in a byte, where a double would take eight. the type is
+// found while parsing and only ever widens; a column is rewritten in the
+// wider type when a value doesn't fit. kernels read a block of rows at a
+// time through widenColumn(), which converts to doubles in a tight loop, so
+// the arithmetic is exactly what it would be on doubles.
+
+#define COLUMN_INT8    0
+#define COLUMN_INT16   1
+#define COLUMN_INT32   2
+#define COLUMN_FLOAT32 3
+#define COLUMN_DOUBLE  4
+
+static const size_t column_widths[] = { 1, 2, 4, 4, 8 };
+
+typedef struct {
+  int type;
+  void * data;
+} Column;
+
+typedef struct {
+  int rows, cols, capacity;
+  Column * columns;
+} Columns;
+
+void initColumns(Columns * columns, int cols, int capacity) {
+
+  int c;
+
+  columns->rows = 0;
+  columns->cols = cols;
+  columns->capacity = capacity;
+  columns->columns = malloc(cols * sizeof(Column));
+  for (c = 0; c < cols; c++) {
+    columns->columns[c].type = COLUMN_INT8;
+    columns->columns[c].data = malloc(capacity > 0 ? capacity : 1);
+  }
+
+}
+
+void freeColumns(Columns * columns) {
+
+  int c;
+
+  for (c = 0; c < columns->cols; c++) {
+    free(columns->columns[c].data);
+  }
+  free(columns->columns);
+
+}
+
+// the narrowest type that holds value exactly
+int valueType(double value) {
+
+  if (value >= INT32_MIN && value <= INT32_MAX && value == (double) (int32_t) value
+      && !(value == 0 && signbit(value))) {
+    if (value >= INT8_MIN && value <= INT8_MAX) {
+      return COLUMN_INT8;
+    }
+    if (value >= INT16_MIN && value <= INT16_MAX) {
+      return COLUMN_INT16;
+    }
+    // beyond 2^24 a float32 loses integers, so an int32 column can't
+    // become float32 later; see widenType()
+    return COLUMN_INT32;
+  }
+  if (value == (double) (float) value) {
+    return COLUMN_FLOAT32;
+  }
+
+  return COLUMN_DOUBLE;
+
+}
+
+// the type a column of type current needs to also hold values of type need
+int widenType(int current, int need) {
+
+  if (need <= current) {
+    return current;
+  }
+  if (current == COLUMN_INT32 && need == COLUMN_FLOAT32) {
+    return COLUMN_DOUBLE;
+  }
+
+  return need;
+
+}
+
+void storeValue(Column * column, int row, double value) {
+
+  switch (column->type) {
+  case COLUMN_INT8:    ((int8_t *) column->data)[row] = (int8_t) value; break;
+  case COLUMN_INT16:   ((int16_t *) column->data)[row] = (int16_t) value; break;
+  case COLUMN_INT32:   ((int32_t *) column->data)[row] = (int32_t) value; break;
+  case COLUMN_FLOAT32: ((float *) column->data)[row] = (float) value; break;
+  default:             ((double *) column->data)[row] = value; break;
+  }
+
+}
+
+// converts rows [start, start + count) of column to doubles in out
+void widenColumn(const Column * column, int start, int count, double * out) {
+
+  int i;
+
+  switch (column->type) {
+  case COLUMN_INT8: {
+    const int8_t * in = (const int8_t *) column->data + start;
+    for (i = 0; i < count; i++) {
+      out[i] = in[i];
+    }
+    break;
+  }
+  case COLUMN_INT16: {
+    const int16_t * in = (const int16_t *) column->data + start;
+    for (i = 0; i < count; i++) {
+      out[i] = in[i];
+    }
+    break;
+  }
+  case COLUMN_INT32: {
+    const int32_t * in = (const int32_t *) column->data + start;
+    for (i = 0; i < count; i++) {
+      out[i] = in[i];
+    }
+    break;
+  }
+  case COLUMN_FLOAT32: {
+    const float * in = (const float *) column->data + start;
+    for (i = 0; i < count; i++) {
+      out[i] = in[i];
+    }
+    break;
+  }
+  default:
+    memcpy(out, (const double *) column->data + start, count * sizeof(double));
+    break;
+  }
+
+}
+
+// rewrites the rows stored so far in a wider type
+void promoteColumn(Column * column, int rows, int capacity, int type) {
+
+  double block[BLOCK_ROWS];
+  Column wider = { type, malloc((capacity > 0 ? capacity : 1) * column_widths[type]) };
+  int start, i, count;
+
+  for (start = 0; start < rows; start += count) {
+    count = rows - start < BLOCK_ROWS ? rows - start : BLOCK_ROWS;
+    widenColumn(column, start, count, block);
+    for (i = 0; i < count; i++) {
+      storeValue(&wider, start + i, block[i]);
+    }
+  }
+
+  free(column->data);
+  *column = wider;
+
+}
+
+// appends a row of cols values
+void appendColumns(Columns * columns, const double * row) {
+
+  int c;
+
+  for (c = 0; c < columns->cols; c++) {
+    Column * column = &columns->columns[c];
+    int type = widenType(column->type, valueType(row[c]));
+    if (type != column->type) {
+      promoteColumn(column, columns->rows, columns->capacity, type);
+    }
+    storeValue(column, columns->rows, row[c]);
+  }
+  columns->rows++;
+
+}
+
+// fits from the rows left in reader by holding X in memory and forming
+// (X^T X)^-1 X^T Y, with exactly the arithmetic the program always has had:
+// every sum runs over the same terms in the same order as the textbook
+// products of X, X^T and (X^T X)^-1 X^T would. X is kept as compact columns
+// (its column of 1s implied) and read back a block of rows at a time, and
+// X^T and (X^T X)^-1 X^T are never materialized.
+double ** fitInCore(Reader * reader, int num_of_attributes, int num_of_houses) {
+
+    int i, j, k, r, start, count, status = 0;
+    int cols = num_of_attributes + 1;
+    Columns columns;
+
+    initColumns(&columns, num_of_attributes, num_of_houses);
+    double * vector_y = malloc((num_of_houses > 0 ? num_of_houses : 1) * sizeof(double));
+    double * row = malloc(cols * sizeof(double));
+
+    // loops through the given data points, readRows fills the attributes
+    // and the price of one house, which are split between X and Y. Any
+    // malformed row, or a row count that doesn't match the header, abandons
+    // the file.
+    for (i = 0; i < num_of_houses; i++) {
+        if (readRows(reader, row, cols, i, num_of_houses) < 0) {
+            status = -1;
+            break;
+        }
+        appendColumns(&columns, row);
+        vector_y[i] = row[num_of_attributes];
+    }
+
+    if (status == 0) {
+        status = readEnd(reader, num_of_houses);
+    }
+
+    free(row);
+
+    if (status != 0) {
+        freeColumns(&columns);
+        free(vector_y);
+        return NULL;
+    }
+
+    // a block of X^T: row 0 is the 1s, then one row per attribute
+    double ** block = allocMatrix(cols, BLOCK_ROWS);
+    double ** product_x = allocMatrix(cols, cols);
+    double ** vector_w = allocMatrix(cols, 1);
+    double * sums = malloc(BLOCK_ROWS * sizeof(double));
+
+    for (r = 0; r < BLOCK_ROWS; r++) {
+        block[0][r] = 1;
+    }
+
+    // X^T X, upper triangle, then mirrored
+    for (start = 0; start < num_of_houses; start += count) {
+        count = num_of_houses - start < BLOCK_ROWS ? num_of_houses - start : BLOCK_ROWS;
+        for (k = 1; k < cols; k++) {
+            widenColumn(&columns.columns[k - 1], start, count, block[k]);
+        }
+        for (i = 0; i < cols; i++) {
+            for (j = i; j < cols; j++) {
+                double s = product_x[i][j];
+                for (r = 0; r < count; r++) {
+                    s += block[i][r] * block[j][r];
+                }
+                product_x[i][j] = s;
+            }
+        }
+    }
+    for (i = 0; i < cols; i++) {
+        for (j = 0; j < i; j++) {
+            product_x[i][j] = product_x[j][i];
+        }
+    }
+
+    double ** inverse_x = inverseIndependent(product_x, cols, reader->path);
+
+    // W = ((X^T X)^-1 X^T) Y, one block of (X^T X)^-1 X^T at a time
+    for (start = 0; start < num_of_houses; start += count) {
+        count = num_of_houses - start < BLOCK_ROWS ? num_of_houses - start : BLOCK_ROWS;
+        for (k = 1; k < cols; k++) {
+            widenColumn(&columns.columns[k - 1], start, count, block[k]);
+        }
+        for (i = 0; i < cols; i++) {
+            for (r = 0; r < count; r++) {
+                sums[r] = 0;
+            }
+            for (k = 0; k < cols; k++) {
+                double f = inverse_x[i][k];
+                for (r = 0; r < count; r++) {
+                    sums[r] += f * block[k][r];
+                }
+            }
+            double w = vector_w[i][0];
+            for (r = 0; r < count; r++) {
+                w += sums[r] * vector_y[start + r];
+            }
+            vector_w[i][0] = w;
+        }
+    }
+
+    freeColumns(&columns);
+    free(vector_y);
+    free(sums);
+    freeMatrix(block);
+    freeMatrix(product_x);
+    freeMatrix(inverse_x);
+
+    return vector_w;
+
+}
+
+// folds one parsed row into the upper triangle of X^T X and into X^T Y, with
+// Y^T Y after it in product_y[cols] for the residual variance.
+// row[0] is the column of 1s, then the attributes, then the price.
+void accumulateRow(double ** product_x, double ** product_y, const double * row, int cols) {
+
+    int a, c;
+    double y = row[cols];
+
+    for (a = 0; a < cols; a++) {
+        double f = row[a];
+        for (c = a; c < cols; c++) {
+            product_x[a][c] += f * row[c];
+        }
+        product_y[a][0] += f * y;
+    }
+    product_y[cols][0] += y * y;
+
+}
+
+// a training file's rows are summed in ranges of the file, each into its
+// own X^T X and X^T Y, which are then added up in file order. the ranges
+// depend only on the file's size and the number of attributes, never on the
+// number of threads, so neither do the sums: threads just take the ranges in
+// turn. a range is at least RANGE_BYTES, and there are at most MAX_RANGES of
+// them, or fewer if their sums would take more than RANGE_MEMORY. a file
+// that makes a single range is summed row by row as it is read.
+#define RANGE_BYTES (1 << 20)
+#define MAX_RANGES 64
+#define RANGE_MEMORY (64 << 20)
+
+// the number of ranges the bytes of rows of cols columns are summed in
+int rangesFor(double bytes, int cols) {
+
+    double ranges = bytes / RANGE_BYTES;
+    double fit = RANGE_MEMORY / (8.0 * ((double) cols * cols + cols + 1));
+
+    ranges = ranges < MAX_RANGES ? ranges : MAX_RANGES;
+    ranges = ranges < fit ? ranges : fit;
+
+    return ranges > 1 ? (int) ranges : 1;
+
+}
+
+// one range of a training file: the rows whose lines start in [start, end),
+// folded into its own X^T X and X^T Y.
+typedef struct {
+    const char * path;
+    long long start, end;
+    int cols;
+    double ** product_x;
+    double ** product_y;
+    long rows;
+    int status;
+} Shard;
+
+typedef struct {
+    Shard * shards;
+    int count, first, step;
+} ShardWorker;
+
+void accumulateShard(Shard * shard) {
+
+    FILE * file = fopen(shard->path, "r");
+    Reader reader;
+    int status;
+
+    if (file == NULL) {
+        perror(shard->path);
+        shard->status = -1;
+        return;
+    }
+
+    double * row = malloc((shard->cols + 1) * sizeof(double));
+    row[0] = 1;
+
+    shard->product_x = allocMatrix(shard->cols, shard->cols);
+    shard->product_y = allocMatrix(shard->cols + 1, 1);
+
+    initReader(&reader, file, shard->path);
+    status = seekReader(&reader, shard->start, shard->end);
+    while (status == 0 && (status = readRow(&reader, &row[1], shard->cols)) > 0) {
+        accumulateRow(shard->product_x, shard->product_y, row, shard->cols);
+        shard->rows++;
+        status = 0;
+    }
+    shard->status = status < 0 ? -1 : 0;
+
+    free(row);
+    freeReader(&reader);
+    fclose(file);
+
+}
+
+void * accumulateShards(void * arg) {
+
+    ShardWorker * worker = arg;
+    int i;
+
+    for (i = worker->first; i < worker->count; i += worker->step) {
+        accumulateShard(&worker->shards[i]);
+    }
+
+    return NULL;
+
+}
+
+// accumulates the rows after the header (which ends at offset start) in
+// ranges ranges on up to threads threads, then sums the partial products in
+// range order. returns 0, or -1 once a problem has been reported.
+int accumulateParallel(const char * path, long long start, long long size, int cols, int num_of_houses,
+                       int ranges, int threads, double ** product_x, double ** product_y) {
+
+    int i, t, a, c, status = 0;
+    long rows = 0;
+    int workers = threads < ranges ? threads : ranges;
+
+    workers = workers > 0 ? workers : 1;
+    Shard * shards = calloc(ranges, sizeof(Shard));
+    ShardWorker * pool = malloc(workers * sizeof(ShardWorker));
+    pthread_t * ids = malloc(workers * sizeof(pthread_t));
+    long long span = size - start;
+
+    for (i = 0; i < ranges; i++) {
+        shards[i].path = path;
+        shards[i].start = start + span * i / ranges;
+        shards[i].end = start + span * (i + 1) / ranges;
+        shards[i].cols = cols;
+    }
+
+    for (t = 0; t < workers; t++) {
+        pool[t].shards = shards;
+        pool[t].count = ranges;
+        pool[t].first = t;
+        pool[t].step = workers;
+        if (t > 0) {
+            pthread_create(&ids[t], NULL, accumulateShards, &pool[t]);
+        }
+    }
+    accumulateShards(&pool[0]);
+    for (t = 1; t < workers; t++) {
+        pthread_join(ids[t], NULL);
+    }
+
+    for (i = 0; i < ranges; i++) {
+        if (shards[i].status != 0) {
+            status = -1;
+        }
+        if (shards[i].product_x != NULL) {
+            for (a = 0; a < cols; a++) {
+                for (c = a; c < cols; c++) {
+                    product_x[a][c] += shards[i].product_x[a][c];
+                }
+                product_y[a][0] += shards[i].product_y[a][0];
+            }
+            product_y[cols][0] += shards[i].product_y[cols][0];
+        }
+        rows += shards[i].rows;
+        freeMatrix(shards[i].product_x);
+        freeMatrix(shards[i].product_y);
+    }
+
+    if (status == 0 && rows != num_of_houses) {
+        fprintf(stderr, "%s: header promises %d rows, file has %ld\n", path, num_of_houses, rows);
+        status = -1;
+    }
+
+    free(shards);
+    free(pool);
+    free(ids);
+
+    return status;
+
+}
+
+// what scoring needs for prediction intervals besides the weights: the
+// Cholesky factor L of X^T X (over its independent columns, see
+// choleskyIndependent()), the residual variance s^2 and how many standard
+// errors either side of the price to go.
+typedef struct {
+    double ** lower;
+    double variance;
+    double z;
+} Spread;
+
+// folds the rows left in reader into X^T X (upper triangle), X^T Y and Y^T Y
+// (the extra last row of product_y) without keeping them, so memory is
+// O(attributes^2) whatever the number of houses. a file big enough for more
+// than one range is summed range by range, the ranges parsed side by side on
+// up to threads threads. returns 0, or -1 once a problem has been reported.
+int accumulateReader(Reader * reader, int cols, int num_of_houses, int threads,
+                     double ** product_x, double ** product_y) {
+
+    struct stat st;
+    int i, ranges, status = 0;
+    long long start = readerOffset(reader);
+
+    if (reader->file != NULL && fstat(fileno(reader->file), &st) == 0
+        && (ranges = rangesFor((double) st.st_size - start, cols)) > 1) {
+        return accumulateParallel(reader->path, start, st.st_size, cols, num_of_houses, ranges, threads,
+                                  product_x, product_y);
+    }
+
+    double * row = malloc((cols + 1) * sizeof(double));
+    row[0] = 1;
+
+    for (i = 0; i < num_of_houses; i++) {
+        if (readRows(reader, &row[1], cols, i, num_of_houses) < 0) {
+            status = -1;
+            break;
+        }
+        accumulateRow(product_x, product_y, row, cols);
+    }
+
+    if (status == 0) {
+        status = readEnd(reader, num_of_houses);
+    }
+
+    free(row);
+
+    return status;
+
+}
+
+// the weights from accumulated sums of num_of_houses rows, or NULL once a
+// problem has been reported. product_x is used up. if spread isn't NULL it
+// is filled in for prediction intervals; s^2 comes from the sums as
+// (Y^T Y - w^T X^T Y) / (houses - attributes - 1).
+double ** solveSums(double ** product_x, double ** product_y, int cols, long num_of_houses, Spread * spread,
+                    const char * path) {
+
+    int a, c;
+
+    // only the upper triangle was accumulated
+    for (a = 0; a < cols; a++) {
+        for (c = 0; c < a; c++) {
+            product_x[a][c] = product_x[c][a];
+        }
+    }
+
+    // inverse() works in place, so factor first. dependent attributes are
+    // left out of both, and reported by inverseIndependent()
+    int rank = cols;
+    if (spread != NULL) {
+      spread->lower = allocMatrix(cols, cols);
+      rank = choleskyIndependent(product_x, spread->lower, cols, NULL);
+      if (rank < 0) {
+        fprintf(stderr, "%s: X^T X can't be factored, no intervals\n", path);
+        freeMatrix(spread->lower);
+        spread->lower = NULL;
+        return NULL;
+      }
+    }
+
+    double ** inverse_x = inverseIndependent(product_x, cols, path);
+    double ** vector_w = allocMatrix(cols, 1);
+
+    vector_w = multiply(inverse_x, product_y, vector_w, cols, 1, cols);
+
+    if (spread != NULL) {
+      double rss = product_y[cols][0];
+      for (a = 0; a < cols; a++) {
+        rss -= vector_w[a][0] * product_y[a][0];
+      }
+      spread->variance = num_of_houses > rank && rss > 0 ? rss / (num_of_houses - rank) : 0;
+    }
+
+    freeMatrix(inverse_x);
+
+    return vector_w;
+
+}
+
+// fits from the rows left in reader without keeping them. for a file that
+// makes a single range, X^T X comes out bit-for-bit the same as in
+// fitInCore; only the final products are associated differently.
+double ** fitStreaming(Reader * reader, int num_of_attributes, int num_of_houses, int threads, Spread * spread) {
+
+    int cols = num_of_attributes + 1;
+    double ** vector_w = NULL;
+
+    double ** product_x = allocMatrix(cols, cols);
+    double ** product_y = allocMatrix(cols + 1, 1);
+
+    if (accumulateReader(reader, cols, num_of_houses, threads, product_x, product_y) == 0) {
+        vector_w = solveSums(product_x, product_y, cols, num_of_houses, spread, reader->path);
+    }
+
+    freeMatrix(product_x);
+    freeMatrix(product_y);
+
+    return vector_w;
+
+}
+
+// ----- GRAM FILES ----------
+//
+// training can be split across machines with three subcommands that talk
+// through files:
+//
+//   estimate accumulate train... > part.gram
+//   estimate merge part.gram... > all.gram
+//   estimate solve all.gram > model
+//
+// a Gram file holds the sums a model is solved from: X^T X (upper triangle,
+// row by row), X^T Y and Y^T Y, as raw doubles in the machine's byte order,
+// after a header giving the number of rows they cover. sums just add, so
+// Gram files can be merged in any grouping. a model file is text, like the
+// inputs:
+//
+//   model
+//   <attributes>
+//   <attributes + 1>
+//   <w0>
+//   <w1>
+//   ...
+//
+// Gram files and model files are accepted wherever a training file is: a
+// Gram file stands for the rows it was accumulated from, so it can be mixed
+// with training files, and a model file is used as it is, on its own.
+//
+// accumulate --every n keeps a snapshot of the sums after every n rows
+// instead of only the sums of all of them (see SNAPSHOTS).
+
+static const char gram_magic[8] = "estgrm2";
+
+// a Gram file holds count sets of sums. set i covers the first
+// (i + 1) * every rows, and the last one all houses of them; a file without
+// snapshots has every 0 and a single set.
+typedef struct {
+  char magic[8];
+  long long attributes, houses;
+  long long every, count;
+} GramHeader;
+
+// the number of sets of sums in a Gram file
+long long snapshotCount(long long every, long long houses) {
+  return every > 0 && houses > every ? (houses + every - 1) / every : 1;
+}
+
+// the number of doubles in one set of sums
+size_t gramValues(int cols) {
+  return (size_t) cols * (cols + 1) / 2 + cols + 1;
+}
+
+// reads a Gram file's header from the start of file. returns 1 if it is
+// one, otherwise 0 with file rewound.
+int readGramHeader(FILE * file, GramHeader * header) {
+
+  if (fread(header, sizeof(*header), 1, file) == 1 && memcmp(header->magic, gram_magic, sizeof(gram_magic)) == 0
+      && header->attributes >= 0 && header->attributes <= 0x7fffffffL && header->houses >= 0
+      && header->every >= 0 && header->count == snapshotCount(header->every, header->houses)) {
+    return 1;
+  }
+  rewind(file);
+
+  return 0;
+
+}
+
+// reads set number set of a Gram file's sums into sums. returns 0, or -1
+// once a problem has been reported.
+int readSnapshot(FILE * file, const char * path, const GramHeader * header, long long set, double * sums) {
+
+  struct stat st;
+  size_t values = gramValues((int) header->attributes + 1);
+  long long size = (long long) sizeof(*header) + header->count * (long long) (values * sizeof(double));
+
+  if (fstat(fileno(file), &st) != 0 || (long long) st.st_size != size) {
+    fprintf(stderr, "%s: Gram file is %s\n", path, (long long) st.st_size < size ? "truncated"
+                                                    : "longer than its header says");
+    return -1;
+  }
+  if (fseeko(file, (off_t) (sizeof(*header) + set * values * sizeof(double)), SEEK_SET) != 0
+      || fread(sums, sizeof(double), values, file) != values) {
+    perror(path);
+    return -1;
+  }
+
+  return 0;
+
+}
+
+// folds one parsed row into a set of sums laid out as in a Gram file.
+// row[0] is the column of 1s, then the attributes, then the price.
+void accumulatePacked(double * sums, const double * row, int cols) {
+
+  double * product_y = sums + (size_t) cols * (cols + 1) / 2;
+  double y = row[cols];
+  int a, c;
+
+  for (a = 0; a < cols; a++) {
+    double f = row[a];
+    for (c = a; c < cols; c++) {
+      *sums++ += f * row[c];
+    }
+    product_y[a] += f * y;
+  }
+  product_y[cols] += y * y;
+
+}
+
+// adds a set of sums to product_x (upper triangle) and product_y
+void addPacked(const double * sums, int cols, double ** product_x, double ** product_y) {
+
+  int a, c;
+
+  for (a = 0; a < cols; a++) {
+    for (c = a; c < cols; c++) {
+      product_x[a][c] += *sums++;
+    }
+  }
+  for (a = 0; a <= cols; a++) {
+    product_y[a][0] += *sums++;
+  }
+
+}
+
+// the inverse of addPacked(): lays product_x (upper triangle) and
+// product_y out as a set of sums
+void packSums(double ** product_x, double ** product_y, int cols, double * sums) {
+
+  int a, c;
+
+  for (a = 0; a < cols; a++) {
+    for (c = a; c < cols; c++) {
+      *sums++ = product_x[a][c];
+    }
+  }
+  for (a = 0; a <= cols; a++) {
+    *sums++ = product_y[a][0];
+  }
+
+}
+
+// adds the sums over all of a Gram file's rows, its last set, to product_x
+// (upper triangle) and product_y. returns 0, or -1 once a problem has been
+// reported.
+int readGramSums(FILE * file, const char * path, const GramHeader * header, double ** product_x,
+                 double ** product_y) {
+
+  int cols = (int) header->attributes + 1;
+  double * sums = malloc(gramValues(cols) * sizeof(double));
+  int status = readSnapshot(file, path, header, header->count - 1, sums);
+
+  if (status == 0) {
+    addPacked(sums, cols, product_x, product_y);
+  }
+  free(sums);
+
+  return status;
+
+}
+
+// writes a Gram file to file: header, then header->count sets of sums.
+// returns 0, or -1 once a problem has been reported.
+int writeGram(FILE * file, const GramHeader * header, const double * sums) {
+
+  size_t values = header->count * gramValues((int) header->attributes + 1);
+
+  if (fwrite(header, sizeof(*header), 1, file) != 1 || fwrite(sums, sizeof(double), values, file) != values
+      || fflush(file) != 0) {
+    perror("writing the Gram file");
+    return -1;
+  }
+
+  return 0;
+
+}
+
+// a header for a Gram file of a single set of sums
+void initGram(GramHeader * header, int num_of_attributes, long long houses) {
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, gram_magic, sizeof(gram_magic));
+  header->attributes = num_of_attributes;
+  header->houses = houses;
+  header->count = 1;
+}
+
+// writes weights as a model file to file. %.17g reads back as the same
+// double. returns 0, or -1 once a problem has been reported.
+int writeModel(FILE * file, double ** vector_w, int num_of_attributes) {
+
+  int a;
+
+  fprintf(file, "model\n%d\n%d\n", num_of_attributes, num_of_attributes + 1);
+  for (a = 0; a <= num_of_attributes; a++) {
+    fprintf(file, "%.17g\n", vector_w[a][0]);
+  }
+  if (fflush(file) != 0 || ferror(file)) {
+    perror("writing the model");
+    return -1;
+  }
+
+  return 0;
+
+}
+
+// the weights of a model file whose header has been read, or NULL once a
+// problem has been reported
+double ** readModel(Reader * reader, int num_of_attributes, int num_of_weights) {
+
+  int a, cols = num_of_attributes + 1;
+  double ** vector_w = NULL;
+  char msg[96];
+
+  if (num_of_weights != cols) {
+    snprintf(msg, sizeof(msg), "a model of %d attributes has %d weights, not %d", num_of_attributes, cols,
+             num_of_weights);
+    parseError(reader, msg);
+    return NULL;
+  }
+
+  vector_w = allocMatrix(cols, 1);
+  for (a = 0; a < cols; a++) {
+    if (readRows(reader, &vector_w[a][0], 1, a, cols) < 0) {
+      freeMatrix(vector_w);
+      return NULL;
+    }
+  }
+  if (readEnd(reader, cols) != 0) {
+    freeMatrix(vector_w);
+    return NULL;
+  }
+
+  return vector_w;
+
+}
+
+// ----- TRAINING FILES ----------
+//
+// a model can be trained on several files, given one after another or as a
+// glob pattern (expanded here, so a quoted pattern can name more files than
+// a command line holds). the files must agree on the number of attributes.
+// each file is folded into its own X^T X and X^T Y by one of the threads,
+// files being dealt out to the threads in turn, and the sums are added up
+// in file order at the end. with fewer files than threads each file's
+// ranges (see accumulateParallel) are split between threads as well. the
+// order of the additions is fixed by the files alone, so the model doesn't
+// depend on the thread count.
+
+typedef struct {
+  char ** paths;
+  int count;
+} FileList;
+
+// adds the files arg names: those matching it if it's a glob pattern that
+// isn't itself a file, otherwise arg. returns 0, or -1 if nothing matches.
+int addFiles(FileList * list, const char * arg) {
+
+  struct stat st;
+  glob_t found;
+  size_t i;
+
+  if (strpbrk(arg, "*?[") == NULL || stat(arg, &st) == 0) {
+    list->paths = realloc(list->paths, (list->count + 1) * sizeof(char *));
+    list->paths[list->count++] = strdup(arg);
+    return 0;
+  }
+
+  if (glob(arg, 0, NULL, &found) != 0) {
+    fprintf(stderr, "%s: no files match\n", arg);
+    return -1;
+  }
+  list->paths = realloc(list->paths, (list->count + found.gl_pathc) * sizeof(char *));
+  for (i = 0; i < found.gl_pathc; i++) {
+    list->paths[list->count++] = strdup(found.gl_pathv[i]);
+  }
+  globfree(&found);
+
+  return 0;
+
+}
+
+void freeFiles(FileList * list) {
+
+  int i;
+
+  for (i = 0; i < list->count; i++) {
+    free(list->paths[i]);
+  }
+  free(list->paths);
+
+}
+
+// frees count lists
+void freeTraining(FileList * lists, int count) {
+
+  int i;
+
+  for (i = 0; i < count; i++) {
+    freeFiles(&lists[i]);
+  }
+  free(lists);
+
+}
+
+// one training file's sums. with every set, the rows are instead summed a
+// stretch of every rows at a time into buckets, counting rows from first_row
+// (see SNAPSHOTS)
+typedef struct {
+  const char * path;
+  int attributes, threads;
+  double ** product_x;
+  double ** product_y;
+  long long every, first_row;
+  double * buckets;
+  long long houses;
+  int status;
+} FileSums;
+
+typedef struct {
+  FileSums * files;
+  int count, first, step;
+} FileWorker;
+
+// folds the rows left in reader into their buckets. returns 0, or -1 once a
+// problem has been reported.
+int accumulateBuckets(Reader * reader, FileSums * sums, int num_of_houses) {
+
+  int i, cols = sums->attributes + 1, status = 0;
+  size_t values = gramValues(cols);
+  long long first = sums->first_row / sums->every;
+  long long last = num_of_houses > 0 ? (sums->first_row + num_of_houses - 1) / sums->every : first;
+  double * row = malloc((cols + 1) * sizeof(double));
+
+  sums->buckets = calloc((last - first + 1) * values, sizeof(double));
+  row[0] = 1;
+
+  for (i = 0; i < num_of_houses; i++) {
+    if (readRows(reader, &row[1], cols, i, num_of_houses) < 0) {
+      status = -1;
+      break;
+    }
+    accumulatePacked(&sums->buckets[((sums->first_row + i) / sums->every - first) * values], row, cols);
+  }
+
+  if (status == 0) {
+    status = readEnd(reader, num_of_houses);
+  }
+  free(row);
+
+  return status;
+
+}
+
+// folds one whole training file into its sums. returns 0, or -1 once a
+// problem has been reported.
+int accumulateFile(FileSums * sums) {
+
+  FILE * file = fopen(sums->path, "r");
+  Reader reader;
+  GramHeader gram;
+  char kind[16];
+  int attributes, houses, status;
+  char msg[96];
+
+  if (file == NULL) {
+    perror(sums->path);
+    return -1;
+  }
+
+  // a Gram file's sums are added as they are
+  if (readGramHeader(file, &gram)) {
+    status = 0;
+    if (sums->every > 0) {
+      fprintf(stderr, "%s: snapshots need the rows themselves, not their sums\n", sums->path);
+      status = -1;
+    } else if (gram.attributes != sums->attributes) {
+      fprintf(stderr, "%s: %lld attributes where the other files have %d\n", sums->path, gram.attributes,
+              sums->attributes);
+      status = -1;
+    }
+    if (status == 0) {
+      status = readGramSums(file, sums->path, &gram, sums->product_x, sums->product_y);
+      sums->houses = gram.houses;
+    }
+    fclose(file);
+    return status;
+  }
+
+  initReader(&reader, file, sums->path);
+  status = readHeader(&reader, kind, sizeof(kind), &attributes, &houses);
+  if (status == 0 && strcmp(kind, "model") == 0) {
+    parseError(&reader, "a model file can't be added to other training files");
+    status = -1;
+  } else if (status == 0 && attributes != sums->attributes) {
+    snprintf(msg, sizeof(msg), "%d attributes where the other files have %d", attributes, sums->attributes);
+    parseError(&reader, msg);
+    status = -1;
+  }
+  if (status == 0 && sums->every > 0) {
+    status = accumulateBuckets(&reader, sums, houses);
+    sums->houses = houses;
+  } else if (status == 0) {
+    status = accumulateReader(&reader, attributes + 1, houses, sums->threads, sums->product_x, sums->product_y);
+    sums->houses = houses;
+  }
+
+  freeReader(&reader);
+  fclose(file);
+
+  return status;
+
+}
+
+void * accumulateFiles(void * arg) {
+
+  FileWorker * worker = arg;
+  int i;
+
+  for (i = worker->first; i < worker->count; i += worker->step) {
+    worker->files[i].status = accumulateFile(&worker->files[i]);
+  }
+
+  return NULL;
+
+}
+
+// folds count files on workers threads, files being dealt out in turn
+void accumulateAll(FileSums * sums, int count, int workers) {
+
+  int t;
+
+  workers = workers > 0 ? workers : 1;
+  FileWorker * pool = malloc(workers * sizeof(FileWorker));
+  pthread_t * ids = malloc(workers * sizeof(pthread_t));
+
+  for (t = 0; t < workers; t++) {
+    pool[t].files = sums;
+    pool[t].count = count;
+    pool[t].first = t;
+    pool[t].step = workers;
+    if (t > 0) {
+      pthread_create(&ids[t], NULL, accumulateFiles, &pool[t]);
+    }
+  }
+  accumulateFiles(&pool[0]);
+
+  for (t = 1; t < workers; t++) {
+    pthread_join(ids[t], NULL);
+  }
+
+  free(pool);
+  free(ids);
+
+}
+
+// adds every file in files into product_x (upper triangle) and product_y,
+// and their rows into houses. returns 0, or -1 once a problem has been
+// reported.
+int sumFiles(const FileList * files, int num_of_attributes, int threads, double ** product_x,
+             double ** product_y, long long * houses) {
+
+  int i, a, c, status = 0;
+  int cols = num_of_attributes + 1;
+  int workers = threads < files->count ? threads : files->count;
+
+  FileSums * sums = calloc(files->count, sizeof(FileSums));
+
+  for (i = 0; i < files->count; i++) {
+    sums[i].path = files->paths[i];
+    sums[i].attributes = num_of_attributes;
+    sums[i].threads = threads / workers;
+    sums[i].product_x = allocMatrix(cols, cols);
+    sums[i].product_y = allocMatrix(cols + 1, 1);
+  }
+
+  accumulateAll(sums, files->count, workers);
+
+  for (i = 0; i < files->count; i++) {
+    if (sums[i].status != 0) {
+      status = -1;
+    }
+    for (a = 0; a < cols; a++) {
+      for (c = a; c < cols; c++) {
+        product_x[a][c] += sums[i].product_x[a][c];
+      }
+      product_y[a][0] += sums[i].product_y[a][0];
+    }
+    product_y[cols][0] += sums[i].product_y[cols][0];
+    *houses += sums[i].houses;
+    freeMatrix(sums[i].product_x);
+    freeMatrix(sums[i].product_y);
+  }
+
+  free(sums);
+
+  return status;
+
+}
+
+// fits one model from every file in files, always streaming. returns the
+// weights, or NULL once a problem has been reported.
+double ** trainFiles(const FileList * files, int num_of_attributes, int threads, Spread * spread) {
+
+  int cols = num_of_attributes + 1;
+  long long houses = 0;
+  double ** vector_w = NULL;
+
+  double ** product_x = allocMatrix(cols, cols);
+  double ** product_y = allocMatrix(cols + 1, 1);
+
+  if (sumFiles(files, num_of_attributes, threads, product_x, product_y, &houses) == 0) {
+    vector_w = solveSums(product_x, product_y, cols, houses, spread, files->paths[0]);
+  }
+
+  freeMatrix(product_x);
+  freeMatrix(product_y);
+
+  return vector_w;
+
+}
+
+// ----- DEADLINE ----------
+//
+// --deadline s gives training s seconds in all, shared out between the
+// models, so that a dashboard gets a model in time even from more rows than
+// can be read in time. the training files are cut into pieces of about
+// PIECE_BYTES, and the pieces are read in bit-reversed order, which spreads
+// them over all of the files from the start: whenever reading stops, the
+// rows read are a sample of the whole rather than its beginning. the sums of
+// any rows make a valid model, so reading just stops at the deadline
+// (checked every DEADLINE_CHECK rows) or once every piece is in, and the
+// model is solved once from what was read. each thread always reads its
+// first piece whole, so there is a model however short the deadline.
+//
+// how many rows were used is reported on stderr, with the residual standard
+// error and, when not every row was read, each weight's standard error times
+// sqrt(1 - used / rows): roughly how far it is from the weight all the rows
+// would give.
+
+#define PIECE_BYTES (256 << 10)
+#define DEADLINE_CHECK 1024
+
+// seconds on a clock that only goes forward
+double monotonicSeconds(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+
+}
+
+// the rows of file whose lines start in [start, end); a Gram file is read
+// whole, as one piece with end -1
+typedef struct {
+  int file;
+  long long start, end;
+} Piece;
+
+typedef struct {
+  const FileList * files;
+  const Piece * pieces;
+  const int * order;
+  int count, first, step, cols;
+  double deadline;
+  double ** product_x;
+  double ** product_y;
+  long long rows;
+  int complete, status;
+} Sampler;
+
+// cuts path into pieces, adding its rows to houses. returns 0, or -1 once a
+// problem has been reported.
+int addPieces(const FileList * files, int file, int num_of_attributes, Piece ** pieces, int * count,
+              long long * houses) {
+
+  const char * path = files->paths[file];
+  FILE * input = fopen(path, "r");
+  struct stat st;
+  GramHeader gram;
+  Reader reader;
+  char kind[16];
+  int attributes, rows, status = 0;
+  long long start, size;
+
+  if (input == NULL || fstat(fileno(input), &st) != 0) {
+    perror(path);
+    if (input != NULL) {
+      fclose(input);
+    }
+    return -1;
+  }
+
+  if (readGramHeader(input, &gram)) {
+    fclose(input);
+    if (gram.attributes != num_of_attributes) {
+      fprintf(stderr, "%s: %lld attributes where %s has %d\n", path, gram.attributes, files->paths[0],
+              num_of_attributes);
+      return -1;
+    }
+    *pieces = realloc(*pieces, (*count + 1) * sizeof(Piece));
+    (*pieces)[*count].file = file;
+    (*pieces)[*count].start = 0;
+    (*pieces)[*count].end = -1;
+    (*count)++;
+    *houses += gram.houses;
+    return 0;
+  }
+
+  initReader(&reader, input, path);
+  status = readHeader(&reader, kind, sizeof(kind), &attributes, &rows);
+  if (status == 0 && strcmp(kind, "model") == 0) {
+    parseError(&reader, "a model file can't be added to other training files");
+    status = -1;
+  } else if (status == 0 && attributes != num_of_attributes) {
+    fprintf(stderr, "%s: %d attributes where %s has %d\n", path, attributes, files->paths[0], num_of_attributes);
+    status = -1;
+  }
+
+  if (status == 0) {
+    size = st.st_size;
+    for (start = readerOffset(&reader); start < size; start += PIECE_BYTES) {
+      *pieces = realloc(*pieces, (*count + 1) * sizeof(Piece));
+      (*pieces)[*count].file = file;
+      (*pieces)[*count].start = start;
+      (*pieces)[*count].end = start + PIECE_BYTES < size ? start + PIECE_BYTES : -1;
+      (*count)++;
+    }
+    *houses += rows;
+  }
+
+  freeReader(&reader);
+  fclose(input);
+
+  return status;
+
+}
+
+// folds one piece into sampler's sums. returns 1 if it was read whole, 0 if
+// the deadline came first, or -1 once a problem has been reported.
+int samplePiece(Sampler * sampler, const Piece * piece, int whole) {
+
+  const char * path = sampler->files->paths[piece->file];
+  FILE * file = fopen(path, "r");
+  GramHeader gram;
+  Reader reader;
+  int status, stopped = 0, cols = sampler->cols;
+  long rows = 0;
+
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  if (piece->end < 0 && readGramHeader(file, &gram)) {
+    status = readGramSums(file, path, &gram, sampler->product_x, sampler->product_y) == 0 ? 1 : -1;
+    sampler->rows += status > 0 ? gram.houses : 0;
+    fclose(file);
+    return status;
+  }
+
+  double * row = malloc((cols + 1) * sizeof(double));
+  row[0] = 1;
+
+  initReader(&reader, file, path);
+  status = seekReader(&reader, piece->start, piece->end);
+  while (status == 0 && (status = readRow(&reader, &row[1], cols)) > 0) {
+    accumulateRow(sampler->product_x, sampler->product_y, row, cols);
+    status = 0;
+    if (++rows % DEADLINE_CHECK == 0 && !whole && monotonicSeconds() >= sampler->deadline) {
+      stopped = 1;
+      break;
+    }
+  }
+  sampler->rows += rows;
+  status = status < 0 ? -1 : stopped ? 0 : 1;
+
+  free(row);
+  freeReader(&reader);
+  fclose(file);
+
+  return status;
+
+}
+
+void * samplePieces(void * arg) {
+
+  Sampler * sampler = arg;
+  int i, status = 1;
+
+  for (i = sampler->first; i < sampler->count && status > 0; i += sampler->step) {
+    if (i > sampler->first && monotonicSeconds() >= sampler->deadline) {
+      status = 0;
+      break;
+    }
+    status = samplePiece(sampler, &sampler->pieces[sampler->order[i]], i == sampler->first);
+  }
+  sampler->complete = status > 0;
+  sampler->status = status < 0 ? -1 : 0;
+
+  return NULL;
+
+}
+
+// fits one model from as many rows of files as can be read before deadline
+// (on monotonicSeconds()'s clock). returns the weights, or NULL once a
+// problem has been reported.
+double ** trainByDeadline(const FileList * files, int num_of_attributes, int threads, Spread * spread,
+                          double deadline) {
+
+  int i, t, a, c, bits, status = 0, count = 0, complete = 1;
+  int cols = num_of_attributes + 1;
+  long long houses = 0, rows = 0;
+  double started = monotonicSeconds();
+  Piece * pieces = NULL;
+  double ** vector_w = NULL;
+
+  for (i = 0; i < files->count && status == 0; i++) {
+    status = addPieces(files, i, num_of_attributes, &pieces, &count, &houses);
+  }
+  if (status != 0 || count == 0) {
+    if (status == 0) {
+      fprintf(stderr, "%s: no rows to train on\n", files->paths[0]);
+    }
+    free(pieces);
+    return NULL;
+  }
+
+  // piece numbers with their bits reversed, skipping those past the end
+  int * order = malloc(count * sizeof(int));
+  for (bits = 0; (1 << bits) < count; bits++);
+  for (i = 0, t = 0; t < (1 << bits); t++) {
+    int r = 0;
+    for (a = 0; a < bits; a++) {
+      r |= ((t >> a) & 1) << (bits - 1 - a);
+    }
+    if (r < count) {
+      order[i++] = r;
+    }
+  }
+
+  int workers = threads < count ? threads : count;
+  Sampler * samplers = calloc(workers, sizeof(Sampler));
+  pthread_t * ids = malloc(workers * sizeof(pthread_t));
+
+  for (t = 0; t < workers; t++) {
+    samplers[t].files = files;
+    samplers[t].pieces = pieces;
+    samplers[t].order = order;
+    samplers[t].count = count;
+    samplers[t].first = t;
+    samplers[t].step = workers;
+    samplers[t].cols = cols;
+    samplers[t].deadline = deadline;
+    samplers[t].product_x = allocMatrix(cols, cols);
+    samplers[t].product_y = allocMatrix(cols + 1, 1);
+    if (t > 0) {
+      pthread_create(&ids[t], NULL, samplePieces, &samplers[t]);
+    }
+  }
+  samplePieces(&samplers[0]);
+
+  double ** product_x = allocMatrix(cols, cols);
+  double ** product_y = allocMatrix(cols + 1, 1);
+
+  for (t = 0; t < workers; t++) {
+    if (t > 0) {
+      pthread_join(ids[t], NULL);
+    }
+    if (samplers[t].status != 0) {
+      status = -1;
+    }
+    complete = complete && samplers[t].complete;
+    for (a = 0; a < cols; a++) {
+      for (c = a; c < cols; c++) {
+        product_x[a][c] += samplers[t].product_x[a][c];
+      }
+      product_y[a][0] += samplers[t].product_y[a][0];
+    }
+    product_y[cols][0] += samplers[t].product_y[cols][0];
+    rows += samplers[t].rows;
+    freeMatrix(samplers[t].product_x);
+    freeMatrix(samplers[t].product_y);
+  }
+
+  // the files together, for messages
+  char name[4096];
+  if (files->count > 1) {
+    snprintf(name, sizeof(name), "%s and %d more files", files->paths[0], files->count - 1);
+  } else {
+    snprintf(name, sizeof(name), "%s", files->paths[0]);
+  }
+
+  if (status == 0 && complete && rows != houses) {
+    fprintf(stderr, files->count > 1 ? "%s: headers promise %lld rows, files have %lld\n"
+                                     : "%s: header promises %lld rows, file has %lld\n", name, houses, rows);
+    status = -1;
+  }
+
+  // the weights' standard errors need the diagonal of (X^T X)^-1, and
+  // solveSums() uses X^T X up
+  double ** gram = allocMatrix(cols, cols);
+  double ** lower = allocMatrix(cols, cols);
+  double * unit = malloc(cols * sizeof(double));
+  int rank = -1;
+
+  for (a = 0; a < cols; a++) {
+    for (c = a; c < cols; c++) {
+      gram[a][c] = gram[c][a] = product_x[a][c];
+    }
+  }
+  if (status == 0) {
+    rank = choleskyIndependent(gram, lower, cols, NULL);
+    vector_w = solveSums(product_x, product_y, cols, rows, spread, files->paths[0]);
+  }
+
+  if (vector_w != NULL) {
+    double rss = product_y[cols][0], s = 0;
+    for (a = 0; a < cols; a++) {
+      rss -= vector_w[a][0] * product_y[a][0];
+    }
+    int fitted = rank >= 0 ? rank : cols;
+    s = rows > fitted && rss > 0 ? sqrt(rss / (rows - fitted)) : 0;
+    fprintf(stderr, "%s: --deadline: trained on %lld of %lld rows (%.1f%%) in %.2f s, residual standard error %g\n",
+            name, rows, houses, houses > 0 ? 100.0 * rows / houses : 100.0, monotonicSeconds() - started,
+            s);
+    if (!complete && rank >= 0) {
+      double sampled = houses > rows ? sqrt(1 - (double) rows / houses) : 0;
+      fprintf(stderr, "%s: --deadline: weights' standard errors from sampling:", name);
+      for (a = 0; a < cols; a++) {
+        for (c = 0; c < cols; c++) {
+          unit[c] = c == a;
+        }
+        choleskySolve(lower, unit, cols);
+        fprintf(stderr, " %g", s * sqrt(unit[a] > 0 ? unit[a] : 0) * sampled);
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+
+  freeMatrix(gram);
+  freeMatrix(lower);
+  free(unit);
+  freeMatrix(product_x);
+  freeMatrix(product_y);
+  free(samplers);
+  free(ids);
+  free(order);
+  free(pieces);
+
+  return vector_w;
+
+}
+
+// fits a model from files with the strategy mode on threads threads, or
+// with a deadline (see DEADLINE) if deadline isn't 0. returns the weights, or
+// NULL once a problem has been reported.
+double ** train(const FileList * files, int * attributes, int mode, int threads, Spread * spread, double deadline) {
+    const char * path = files->paths[0];
+    FILE *file1;
+    file1 = fopen(path, "r");
+    if (file1 == NULL) {
+      perror(path);
+      return NULL;
+    }
+
+    int num_of_attributes = 0, num_of_houses;
+    double ** vector_w = NULL;
+
+    // Gram files go with the other files, however many there are
+    GramHeader gram;
+    if (readGramHeader(file1, &gram)) {
+      fclose(file1);
+      *attributes = (int) gram.attributes;
+      return deadline > 0 ? trainByDeadline(files, *attributes, threads, spread, deadline)
+                          : trainFiles(files, *attributes, threads, spread);
+    }
+
+    Reader reader;
+    initReader(&reader, file1, path);
+
+    char train[16] = "";
+    if (readHeader(&reader, train, sizeof(train), &num_of_attributes, &num_of_houses) == 0) {
+      if (strcmp(train, "model") == 0 && (files->count > 1 || spread != NULL)) {
+        parseError(&reader, files->count > 1 ? "a model file can't be added to other training files"
+                                             : "a model file has no intervals, give its Gram file instead");
+      } else if (strcmp(train, "model") == 0) {
+        vector_w = readModel(&reader, num_of_attributes, num_of_houses);
+      } else if (deadline > 0) {
+        vector_w = trainByDeadline(files, num_of_attributes, threads, spread, deadline);
+      } else if (files->count > 1) {
+        vector_w = trainFiles(files, num_of_attributes, threads, spread);
+      } else if (mode == MODE_INCORE && spread == NULL) {
+        vector_w = fitInCore(&reader, num_of_attributes, num_of_houses);
+      } else {
+        vector_w = fitStreaming(&reader, num_of_attributes, num_of_houses, threads, spread);
+      }
+    }
+
+    freeReader(&reader);
+    fclose(file1);
+
+    *attributes = num_of_attributes;
+    return vector_w;
+
+}
+
+// ----- TINY INPUTS ----------
+//
+// most inputs are a handful of rows, where the process is all start-up: the
+// cgroup probes, stdio buffers, matrix allocations and thread decisions cost
+// more than the arithmetic. when both files are at most TINY_BYTES and the
+// training file's header promises at most TINY_ROWS rows of TINY_ATTRIBUTES
+// attributes, the plain train-and-score run is done here instead: each file
+// is taken in with one read(), parsed by a Reader over that memory, and
+// fitted with the in-core arithmetic, single-threaded. the files, matrices
+// and stdout's buffer are static arrays sized to those limits (this runs
+// once, before any thread), so nothing is allocated, on the heap or in a
+// large stack frame. the results are the ones fitInCore() and predict()
+// would give, dependent attributes left out included.
+
+#define TINY_BYTES (32 << 10)
+#define TINY_ROWS 64
+#define TINY_ATTRIBUTES 15
+#define TINY_SKIP 1
+
+// reads all of a file of at most TINY_BYTES into buf. returns its length, -1
+// once a problem has been reported, or -2 if the file is too big.
+long readTiny(const char * path, char * buf) {
+
+  struct stat st;
+  long len = 0;
+  ssize_t n = 1;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  if (!S_ISREG(st.st_mode) || st.st_size > TINY_BYTES) {
+    close(fd);
+    return -2;
+  }
+
+  while (len < TINY_BYTES && (n = read(fd, buf + len, TINY_BYTES - len)) > 0) {
+    len += n;
+  }
+  close(fd);
+  if (n < 0) {
+    perror(path);
+    return -1;
+  }
+
+  return len;
+
+}
+
+// fits the training file and scores the data file if both are tiny.
+// returns 0, -1 once a problem has been reported, or TINY_SKIP if the input
+// isn't tiny after all and nothing has been printed.
+int estimateTiny(const char * train_path, const char * data_path) {
+
+  static char train_text[TINY_BYTES], data_text[TINY_BYTES], out_text[TINY_BYTES];
+  static double x[TINY_ROWS][TINY_ATTRIBUTES + 1], x_t[TINY_ATTRIBUTES + 1][TINY_ROWS];
+  static double result[TINY_ATTRIBUTES + 1][TINY_ROWS];
+  static double product[TINY_ATTRIBUTES + 1][TINY_ATTRIBUTES + 1];
+  static double identity[TINY_ATTRIBUTES + 1][TINY_ATTRIBUTES + 1];
+  double y[TINY_ROWS], w[TINY_ATTRIBUTES + 1], row[TINY_ATTRIBUTES + 1];
+  int kept[TINY_ATTRIBUTES + 1];
+  double * x_rows[TINY_ROWS], * x_t_rows[TINY_ATTRIBUTES + 1], * result_rows[TINY_ATTRIBUTES + 1];
+  double * product_rows[TINY_ATTRIBUTES + 1], * identity_rows[TINY_ATTRIBUTES + 1];
+  double * y_rows[TINY_ROWS], * w_rows[TINY_ATTRIBUTES + 1];
+  Reader train, data;
+  char kind[16];
+  int i, j, c, k, n, rank, data_k, data_n;
+
+  long train_len = readTiny(train_path, train_text);
+  long data_len = train_len >= 0 ? readTiny(data_path, data_text) : train_len;
+  if (train_len == -1 || data_len == -1) {
+    return -1;
+  }
+  // Gram and model files are left to train()
+  if (train_len < 0 || data_len < 0
+      || (train_len >= (long) sizeof(gram_magic) && memcmp(train_text, gram_magic, sizeof(gram_magic)) == 0)) {
+    return TINY_SKIP;
+  }
+
+  initMemoryReader(&train, train_text, train_len, train_path);
+  initMemoryReader(&data, data_text, data_len, data_path);
+  if (readHeader(&train, kind, sizeof(kind), &k, &n) != 0) {
+    return -1;
+  }
+  if (strcmp(kind, "model") == 0) {
+    return TINY_SKIP;
+  }
+  if (readHeader(&data, kind, sizeof(kind), &data_k, &data_n) != 0) {
+    return -1;
+  }
+  if (k > TINY_ATTRIBUTES || n > TINY_ROWS) {
+    return TINY_SKIP;
+  }
+
+  // from here on this is the run, and nothing has been written to stdout
+  // yet, so stdio can be given a buffer rather than allocate one
+  setvbuf(stdout, out_text, _IOFBF, sizeof(out_text));
+  if (k != data_k) {
+    printf("error\n");
+    return 0;
+  }
+
+  int cols = k + 1;
+  for (i = 0; i < TINY_ROWS; i++) {
+    x_rows[i] = x[i];
+    y_rows[i] = &y[i];
+  }
+  for (i = 0; i < cols; i++) {
+    x_t_rows[i] = x_t[i];
+    result_rows[i] = result[i];
+    product_rows[i] = product[i];
+    identity_rows[i] = identity[i];
+    w_rows[i] = &w[i];
+  }
+
+  for (i = 0; i < n; i++) {
+    if (readRows(&train, row, cols, i, n) < 0) {
+      return -1;
+    }
+    x[i][0] = 1;
+    for (j = 1; j < cols; j++) {
+      x[i][j] = row[j - 1];
+    }
+    y[i] = row[k];
+  }
+  if (readEnd(&train, n) != 0) {
+    return -1;
+  }
+
+  // as in fitInCore: (X^T X)^-1 X^T, then times Y
+  transpose(x_rows, x_t_rows, n, cols);
+  multiply(x_t_rows, x_rows, insertZeroes(product_rows, cols, cols), cols, cols, n);
+  rank = independentColumns(product_rows, cols, kept, identity_rows);
+  if (rank < cols) {
+    // as inverseIndependent(): the dependent columns are reported and the
+    // rest solved for on their own, here by moving them to the front of X
+    reportDependent(train_path, kept, cols);
+    for (i = 0; i < n; i++) {
+      for (c = 0, j = 0; j < cols; j++) {
+        if (kept[j]) {
+          x[i][c++] = x[i][j];
+        }
+      }
+    }
+    transpose(x_rows, x_t_rows, n, rank);
+    multiply(x_t_rows, x_rows, insertZeroes(product_rows, rank, rank), rank, rank, n);
+  }
+  inverseInto(product_rows, identity_rows, rank, rank);
+  multiply(identity_rows, x_t_rows, insertZeroes(result_rows, rank, n), rank, n, rank);
+  multiply(result_rows, y_rows, insertZeroes(w_rows, rank, 1), rank, 1, n);
+
+  // and back into place, with weight 0 for the columns left out
+  for (j = cols - 1, c = rank - 1; j >= 0; j--) {
+    w[j] = kept[j] ? w[c--] : 0;
+  }
+
+  // as in predict: 0, then each term in order
+  for (i = 0; i < data_n; i++) {
+    if (readRows(&data, &row[1], k, i, data_n) < 0) {
+      return -1;
+    }
+    double price = 0;
+    row[0] = 1;
+    for (j = 0; j < cols; j++) {
+      price += row[j] * w[j];
+    }
+    printf("%.0f\n", price);
+  }
+
+  return readEnd(&data, data_n);
+
+}
+
+// ----- SLIDING WINDOW ----------
+//
+// fits the model to the last window rows of the training file, again for
+// every row once the window is full, and prints each step's weights. the
+// window's rows are kept in a ring buffer; as a row arrives and the oldest
+// leaves, X^T X and X^T Y are adjusted and the Cholesky factor of X^T X is
+// updated and downdated, so each step costs O(attributes^2) rather than a
+// refit of the window. X^T X and X^T Y are recomputed from the ring once per
+// window so rounding in the running sums can't build up.
+
+// rebuilds X^T X and X^T Y from the rows in the ring
+void windowSums(double ** ring, int rows, int cols, double ** product_x, double ** product_y) {
+
+    int i, a, c;
+
+    insertZeroes(product_x, cols, cols);
+    insertZeroes(product_y, cols + 1, 1);
+    for (i = 0; i < rows; i++) {
+        accumulateRow(product_x, product_y, ring[i], cols);
+    }
+    for (a = 0; a < cols; a++) {
+        for (c = 0; c < a; c++) {
+            product_x[a][c] = product_x[c][a];
+        }
+    }
+
+}
+
+// returns 0, or -1 once a problem with the file has been reported
+int slideWindow(const char * path, int window) {
+
+    FILE * file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    Reader reader;
+    initReader(&reader, file, path);
+
+    int i, a, c, num_of_attributes, num_of_houses, status;
+    char kind[16];
+
+    status = readHeader(&reader, kind, sizeof(kind), &num_of_attributes, &num_of_houses);
+    if (status != 0) {
+        freeReader(&reader);
+        fclose(file);
+        return -1;
+    }
+
+    int cols = num_of_attributes + 1;
+    int factored = 0;
+
+    // each ring row is laid out as accumulateRow() expects: 1, attributes, price
+    double ** ring = allocMatrix(window, cols + 1);
+    double ** product_x = allocMatrix(cols, cols);
+    double ** product_y = allocMatrix(cols + 1, 1);
+    double ** lower = allocMatrix(cols, cols);
+    double * work = malloc(cols * sizeof(double));
+    double * vector_w = malloc(cols * sizeof(double));
+    double * row = malloc((cols + 1) * sizeof(double));
+
+    row[0] = 1;
+
+    for (i = 0; i < num_of_houses; i++) {
+        if (readRows(&reader, &row[1], cols, i, num_of_houses) < 0) {
+            status = -1;
+            break;
+        }
+
+        double * slot = ring[i % window];
+        double y = row[cols];
+
+        if (i >= window) {
+            // the oldest row leaves the sums and the factor
+            double old_y = slot[cols];
+            for (a = 0; a < cols; a++) {
+                for (c = 0; c < cols; c++) {
+                    product_x[a][c] -= slot[a] * slot[c];
+                }
+                product_y[a][0] -= slot[a] * old_y;
+                work[a] = slot[a];
+            }
+            if (factored && choleskyRankOne(lower, work, cols, -1) != 0) {
+                factored = 0;
+            }
+        }
+
+        memcpy(slot, row, (cols + 1) * sizeof(double));
+        for (a = 0; a < cols; a++) {
+            for (c = 0; c < cols; c++) {
+                product_x[a][c] += row[a] * row[c];
+            }
+            product_y[a][0] += row[a] * y;
+            work[a] = row[a];
+        }
+        if (factored) {
+            choleskyRankOne(lower, work, cols, 1);
+        }
+
+        if (i + 1 < window) {
+            continue;
+        }
+
+        // once per window start over from the rows themselves
+        if ((i + 1) % window == 0) {
+            windowSums(ring, window, cols, product_x, product_y);
+            factored = 0;
+        }
+        if (!factored) {
+            factored = cholesky(product_x, lower, cols) == 0;
+        }
+        if (!factored) {
+            // the window's attributes are dependent; nothing to report yet
+            continue;
+        }
+
+        for (a = 0; a < cols; a++) {
+            vector_w[a] = product_y[a][0];
+        }
+        choleskySolve(lower, vector_w, cols);
+
+        printf("%d", i + 1);
+        for (a = 0; a < cols; a++) {
+            printf(" %f", vector_w[a]);
+        }
+        printf("\n");
+    }
+
+    if (status == 0) {
+        status = readEnd(&reader, num_of_houses);
+    }
+
+    freeMatrix(ring);
+    freeMatrix(product_x);
+    freeMatrix(product_y);
+    freeMatrix(lower);
+    free(work);
+    free(vector_w);
+    free(row);
+    freeReader(&reader);
+    fclose(file);
+
+    return status;
+
+}
+
+// ----- ROW INDEX ----------
+//
+// with --index a data file that is scored in full is indexed on the way:
+// about every INDEX_STRIDE rows the row number, the offset of the line it
+// starts on and the number of lines before it are noted, along with the
+// least and greatest value of each attribute over the rows up to the next
+// entry. the list is saved next to the file as path.idx, so nothing is
+// written beside the data unless asked for. later runs that find an index
+// matching the file's size and modification time use it to start threads on
+// row boundaries, with --rows A:B to jump straight to row A (counting from 0)
+// and stop before row B, and with --filter to pass over the stretches of
+// rows that can't match. --rows without an index builds one for the run,
+// and keeps it only with --index. an index that can't be written (the
+// directory is read-only, say) is quietly not kept.
+
+#define INDEX_STRIDE 4096
+
+static const char index_magic[8] = "estidx2";
+
+typedef struct {
+  long long row, offset, line;
+} IndexEntry;
+
+// what's saved ahead of the entries and their bounds. size and mtime
+// identify the version of the file the index describes.
+typedef struct {
+  char magic[8];
+  long long size, mtime_sec, mtime_nsec;
+  long long rows, count, attributes;
+} IndexHeader;
+
+// bounds holds 2 * attributes values per entry: each attribute's least
+// value, then each one's greatest
+typedef struct {
+  IndexHeader header;
+  IndexEntry * entries;
+  double * bounds;
+  long long capacity;
+} RowIndex;
+
+void initIndex(RowIndex * index, int attributes) {
+  memset(&index->header, 0, sizeof(index->header));
+  memcpy(index->header.magic, index_magic, sizeof(index_magic));
+  index->header.attributes = attributes;
+  index->entries = NULL;
+  index->bounds = NULL;
+  index->capacity = 0;
+}
+
+void freeIndex(RowIndex * index) {
+  free(index->entries);
+  free(index->bounds);
+  index->entries = NULL;
+  index->bounds = NULL;
+}
+
+// appends an entry with empty bounds and returns its bounds
+double * addIndexEntry(RowIndex * index, long long row, long long offset, long long line) {
+
+  long long a, n = index->header.attributes;
+  IndexEntry * entry;
+
+  if (index->header.count == index->capacity) {
+    index->capacity = index->capacity > 0 ? 2 * index->capacity : 64;
+    index->entries = realloc(index->entries, index->capacity * sizeof(IndexEntry));
+    index->bounds = realloc(index->bounds, (index->capacity * 2 * n + 1) * sizeof(double));
+  }
+  entry = &index->entries[index->header.count];
+  entry->row = row;
+  entry->offset = offset;
+  entry->line = line;
+
+  double * bounds = &index->bounds[index->header.count * 2 * n];
+  for (a = 0; a < n; a++) {
+    bounds[a] = INFINITY;
+    bounds[n + a] = -INFINITY;
+  }
+  index->header.count++;
+
+  return bounds;
+
+}
+
+// widens the last entry's bounds to take in a row of attributes
+void boundRow(RowIndex * index, const double * row) {
+
+  long long a, n = index->header.attributes;
+  double * bounds = &index->bounds[(index->header.count - 1) * 2 * n];
+
+  for (a = 0; a < n; a++) {
+    bounds[a] = row[a] < bounds[a] ? row[a] : bounds[a];
+    bounds[n + a] = row[a] > bounds[n + a] ? row[a] : bounds[n + a];
+  }
+
+}
+
+// loads path's index. returns 1 if there was one describing path as it is
+// now, otherwise 0 with index left empty.
+int loadIndex(const char * path, RowIndex * index) {
+
+  char index_path[4096];
+  struct stat st;
+  FILE * file;
+  IndexHeader header;
+  int found = 0;
+
+  initIndex(index, 0);
+  snprintf(index_path, sizeof(index_path), "%s.idx", path);
+  if (stat(path, &st) != 0 || (file = fopen(index_path, "rb")) == NULL) {
+    return 0;
+  }
+
+  if (fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, index_magic, sizeof(index_magic)) == 0
+      && header.size == (long long) st.st_size && header.mtime_sec == (long long) st.st_mtim.tv_sec
+      && header.mtime_nsec == (long long) st.st_mtim.tv_nsec && header.count >= 0
+      && header.count <= header.rows + 1 && header.attributes >= 0 && header.attributes <= 0x7fffffff) {
+    size_t bounds = header.count * 2 * header.attributes;
+    index->entries = malloc((header.count > 0 ? header.count : 1) * sizeof(IndexEntry));
+    index->bounds = malloc((bounds + 1) * sizeof(double));
+    index->capacity = header.count;
+    found = fread(index->entries, sizeof(IndexEntry), header.count, file) == (size_t) header.count
+            && fread(index->bounds, sizeof(double), bounds, file) == bounds;
+    if (found) {
+      index->header = header;
+    } else {
+      freeIndex(index);
+      index->capacity = 0;
+    }
+  }
+  fclose(file);
+
+  return found;
+
+}
+
+// saves index as path's, stamped with path's current size and mtime. the
+// index is written beside its final name and renamed into place, so readers
+// never see half of one. returns 0, or -1 if it couldn't be saved.
+int saveIndex(const char * path, RowIndex * index) {
+
+  char index_path[4096], tmp_path[4096];
+  struct stat st;
+  FILE * file;
+  size_t bounds = index->header.count * 2 * index->header.attributes;
+  int ok;
+
+  snprintf(index_path, sizeof(index_path), "%s.idx", path);
+  snprintf(tmp_path, sizeof(tmp_path), "%s.idx.%d", path, (int) getpid());
+  if (stat(path, &st) != 0 || (file = fopen(tmp_path, "wb")) == NULL) {
+    return -1;
+  }
+
+  index->header.size = st.st_size;
+  index->header.mtime_sec = st.st_mtim.tv_sec;
+  index->header.mtime_nsec = st.st_mtim.tv_nsec;
+
+  ok = fwrite(&index->header, sizeof(index->header), 1, file) == 1
+       && fwrite(index->entries, sizeof(IndexEntry), index->header.count, file) == (size_t) index->header.count
+       && fwrite(index->bounds, sizeof(double), bounds, file) == bounds;
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(tmp_path, index_path) != 0) {
+    unlink(tmp_path);
+    return -1;
+  }
+
+  return 0;
+
+}
+
+// indexes the rows of attributes values from reader's position on. returns
+// 0, or -1 once a problem has been reported.
+int buildIndex(Reader * reader, RowIndex * index, int attributes) {
+
+  long long rows = 0, offset = readerOffset(reader), line = reader->line;
+  double * row = malloc((attributes > 0 ? attributes : 1) * sizeof(double));
+  int status;
+
+  initIndex(index, attributes);
+  for (;;) {
+    if (rows % INDEX_STRIDE == 0) {
+      addIndexEntry(index, rows, offset, line);
+    }
+    status = readRow(reader, row, attributes);
+    if (status != 1) {
+      break;
+    }
+    boundRow(index, row);
+    rows++;
+    offset = readerOffset(reader);
+    line = reader->line;
+  }
+  // the entry opened for the row that wasn't there
+  if (rows % INDEX_STRIDE == 0) {
+    index->header.count--;
+  }
+  index->header.rows = rows;
+  free(row);
+
+  if (status == 0 && ferror(reader->file)) {
+    perror(reader->path);
+    status = -1;
+  }
+
+  return status;
+
+}
+
+// the offset of the first line at or after offset that index knows starts
+// a row, or offset itself past the last entry
+long long snapOffset(const RowIndex * index, long long offset) {
+
+  long long lo = 0, hi = index->header.count;
+
+  while (lo < hi) {
+    long long mid = lo + (hi - lo) / 2;
+    if (index->entries[mid].offset < offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo < index->header.count ? index->entries[lo].offset : offset;
+
+}
+
+// positions reader at the start of entry's line, reading until before limit,
+// and has it count lines from the entry's line rather than from there
+int seekEntry(Reader * reader, const IndexEntry * entry, long long limit) {
+
+  if (seekReader(reader, entry->offset, limit) != 0) {
+    return -1;
+  }
+  reader->line = entry->line;
+  reader->origin = 0;
+
+  return 0;
+
+}
+
+// the offset of the line row starts on, or the end of the file for the row
+// after the last, and in *line the number of lines before it. reader is
+// moved there to find it. returns -1 if the file can't be positioned.
+long long rowOffset(Reader * reader, const RowIndex * index, long long row, long * line) {
+
+  char * p;
+  char * end;
+  long long lo = 0, hi = index->header.count, at;
+
+  // the last entry at or before row
+  while (hi - lo > 1) {
+    long long mid = lo + (hi - lo) / 2;
+    if (index->entries[mid].row <= row) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (index->header.count == 0 || seekEntry(reader, &index->entries[lo], -1) != 0) {
+    return -1;
+  }
+  for (at = index->entries[lo].row; at < row && nextRowLine(reader, &p, &end); at++);
+  *line = reader->line;
+
+  return readerOffset(reader);
+
+}
+
+// parses --rows A:B, where either side may be left out. last is -1 when B
+// is. returns 0, or -1 if text isn't a range.
+int parseRange(const char * text, long long * first, long long * last) {
+
+  char * rest;
+
+  *first = *text != ':' ? strtoll(text, &rest, 10) : 0;
+  rest = *text != ':' ? rest : (char *) text;
+  *last = -1;
+  if (*rest == ':' && rest[1] != '\0') {
+    *last = strtoll(rest + 1, &rest, 10);
+  } else if (*rest == ':') {
+    rest++;
+  }
+
+  return *rest != '\0' || *first < 0 || (*last >= 0 && *last < *first) ? -1 : 0;
+
+}
+
+// ----- FILTERS ----------
+//
+// with --filter only the rows whose attributes pass every predicate are
+// scored, each printed after its line number in the data file. a predicate
+// is an attribute number (from 1), a comparison and a value, like 2>=3. a
+// block of rows is parsed as usual and then checked one predicate at a
+// time, each a straight pass down one attribute of the block, and the
+// passing rows are packed to the front before the multiply. with an index
+// the stretches of rows whose bounds rule them out aren't read at all.
+
+#define MAX_PREDICATES 16
+
+#define OP_LT 0
+#define OP_LE 1
+#define OP_GT 2
+#define OP_GE 3
+#define OP_EQ 4
+#define OP_NE 5
+
+static const char * op_names[] = { "<", "<=", ">", ">=", "==", "!=" };
+
+typedef struct {
+  int attribute, op;
+  double value;
+} Predicate;
+
+typedef struct {
+  int count;
+  Predicate predicates[MAX_PREDICATES];
+} Filter;
+
+// parses a predicate like 2>=3. returns 0, or -1 if it isn't one.
+int parsePredicate(const char * text, Predicate * predicate) {
+
+  char * rest;
+  int op;
+
+  predicate->attribute = (int) strtol(text, &rest, 10);
+  if (rest == text || predicate->attribute < 1) {
+    return -1;
+  }
+  for (op = OP_NE; op >= OP_LT; op--) {
+    size_t len = strlen(op_names[op]);
+    // <= and >= come up before < and >
+    if (strncmp(rest, op_names[op], len) == 0) {
+      break;
+    }
+  }
+  if (op < OP_LT) {
+    return -1;
+  }
+  predicate->op = op;
+  text = rest + strlen(op_names[op]);
+  predicate->value = strtod(text, &rest);
+
+  return rest == text || *rest != '\0' || !isfinite(predicate->value) ? -1 : 0;
+
+}
+
+// marks in keep which rows of the block pass every predicate. the attributes
+// of row r are x[r][1..]. returns how many pass.
+int keepRows(const Filter * filter, double ** x, int rows, int cols, unsigned char * keep) {
+
+  int i, r, kept = 0;
+
+  memset(keep, 1, rows);
+  for (i = 0; i < filter->count; i++) {
+    const Predicate * predicate = &filter->predicates[i];
+    const double * column = &x[0][predicate->attribute];
+    size_t stride = cols;
+    double v = predicate->value;
+
+    switch (predicate->op) {
+    case OP_LT: for (r = 0; r < rows; r++) keep[r] &= column[r * stride] < v; break;
+    case OP_LE: for (r = 0; r < rows; r++) keep[r] &= column[r * stride] <= v; break;
+    case OP_GT: for (r = 0; r < rows; r++) keep[r] &= column[r * stride] > v; break;
+    case OP_GE: for (r = 0; r < rows; r++) keep[r] &= column[r * stride] >= v; break;
+    case OP_EQ: for (r = 0; r < rows; r++) keep[r] &= column[r * stride] == v; break;
+    default:    for (r = 0; r < rows; r++) keep[r] &= column[r * stride] != v; break;
+    }
+  }
+  for (r = 0; r < rows; r++) {
+    kept += keep[r];
+  }
+
+  return kept;
+
+}
+
+// moves the kept rows of x, and their lines, to the front
+void packRows(double ** x, long * lines, const unsigned char * keep, int rows, int cols) {
+
+  int r, to = 0;
+
+  for (r = 0; r < rows; r++) {
+    if (keep[r]) {
+      if (to != r) {
+        memcpy(x[to], x[r], cols * sizeof(double));
+        lines[to] = lines[r];
+      }
+      to++;
+    }
+  }
+
+}
+
+// whether any row within bounds (see RowIndex) could pass every predicate
+int boundsMatch(const Filter * filter, const double * bounds, int attributes) {
+
+  int i;
+
+  for (i = 0; i < filter->count; i++) {
+    const Predicate * predicate = &filter->predicates[i];
+    double least = bounds[predicate->attribute - 1];
+    double most = bounds[attributes + predicate->attribute - 1];
+    double v = predicate->value;
+    int possible;
+
+    switch (predicate->op) {
+    case OP_LT: possible = least < v; break;
+    case OP_LE: possible = least <= v; break;
+    case OP_GT: possible = most > v; break;
+    case OP_GE: possible = most >= v; break;
+    case OP_EQ: possible = least <= v && v <= most; break;
+    default:    possible = !(least == v && most == v); break;
+    }
+    if (!possible) {
+      return 0;
+    }
+  }
+
+  return 1;
+
+}
+
+// prints a block of rows after their line numbers
+void printNumbered(const long * lines, long base, double ** matrix, int rows, int cols) {
+
+  int i, j;
+
+  for (i = 0; i < rows; i++) {
+    printf("%ld", base + lines[i]);
+    for (j = 0; j < cols; j++) {
+      printf(" %.0f", matrix[i][j]);
+    }
+    printf("\n");
+  }
+
+}
+
+// ----- METRICS ----------
+//
+// with --ref the predictions are checked against a reference file (the true
+// price of each data row, one per line and no header, like data/ref.*.txt);
+// with several models each is checked against the same prices. the check
+// happens as the predictions are made: the reference is streamed alongside
+// the data and each model's errors are folded into running sums, so nothing
+// is kept per row.
+// R^2 needs the variance of the reference, which is tracked with Welford's
+// update rather than from sum and sum of squares, which cancel badly at
+// house-price magnitudes.
+
+typedef struct {
+  double sum_sq, sum_abs, max_abs;
+  double mean, m2;
+} Errors;
+
+typedef struct {
+  FILE * file;
+  Reader reader;
+  int models;
+  long rows;
+  Errors * errors;
+} Metrics;
+
+// returns 0, or -1 if the reference file can't be opened
+int openMetrics(Metrics * metrics, const char * path, int num_of_models) {
+
+  metrics->file = fopen(path, "r");
+  if (metrics->file == NULL) {
+    perror(path);
+    return -1;
+  }
+  initReader(&metrics->reader, metrics->file, path);
+  metrics->models = num_of_models;
+  metrics->rows = 0;
+  metrics->errors = calloc(num_of_models, sizeof(Errors));
+
+  return 0;
+
+}
+
+// scores rows predictions, num_of_models to a row and stored one row after
+// another, against the next rows of the reference. returns 0, or -1 once a
+// problem with the reference has been reported.
+int addMetrics(Metrics * metrics, const double * prices, int rows) {
+
+  int i, m, status;
+  double y;
+
+  for (i = 0; i < rows; i++) {
+    status = readRow(&metrics->reader, &y, 1);
+    if (status <= 0) {
+      if (status == 0) {
+        parseError(&metrics->reader, "reference has fewer rows than the data");
+      }
+      return -1;
+    }
+    metrics->rows++;
+
+    for (m = 0; m < metrics->models; m++) {
+      Errors * errors = &metrics->errors[m];
+      double e = prices[m] - y;
+      double delta = y - errors->mean;
+
+      errors->sum_sq += e * e;
+      errors->sum_abs += fabs(e);
+      if (fabs(e) > errors->max_abs) {
+        errors->max_abs = fabs(e);
+      }
+      errors->mean += delta / metrics->rows;
+      errors->m2 += delta * (y - errors->mean);
+    }
+    prices += metrics->models;
+  }
+
+  return 0;
+
+}
+
+// checks the reference ended with the data and, if all went well, reports
+// each model's errors on stderr. frees metrics either way. returns status,
+// or -1 if the reference has rows left over.
+int closeMetrics(Metrics * metrics, int status) {
+
+  int m;
+  double rest;
+
+  if (status == 0 && readRow(&metrics->reader, &rest, 1) != 0) {
+    parseError(&metrics->reader, "reference has more rows than the data");
+    status = -1;
+  }
+
+  for (m = 0; m < metrics->models && status == 0; m++) {
+    Errors * errors = &metrics->errors[m];
+    double n = metrics->rows > 0 ? metrics->rows : 1;
+
+    if (metrics->models > 1) {
+      fprintf(stderr, "model %d: ", m + 1);
+    }
+    fprintf(stderr, "%ld rows, rmse %.2f, mae %.2f, r2 %.6f, max error %.2f\n", metrics->rows,
+            sqrt(errors->sum_sq / n), errors->sum_abs / n,
+            errors->m2 > 0 ? 1 - errors->sum_sq / errors->m2 : 0, errors->max_abs);
+  }
+
+  free(metrics->errors);
+  freeReader(&metrics->reader);
+  fclose(metrics->file);
+
+  return status;
+
+}
+
+// ----- TOP K ----------
+//
+// with --top K only the K rows with the highest price (from the first model)
+// are printed, highest first, each after its line number in the data file.
+// rows are offered to a bounded min-heap as they are scored, so memory is
+// O(K) and nothing is formatted until the end; each scoring thread keeps its
+// own heap and they are merged in order. ties go to the earlier line, which
+// makes the result independent of how the rows were split.
+
+typedef struct {
+  double key;
+  long long line;
+  int slot;           // where its printed values are in TopK.values
+} Ranked;
+
+typedef struct {
+  int k, width, count;
+  Ranked * heap;
+  double * values;
+} TopK;
+
+#define MAX_TOP (1 << 24)
+
+void initTop(TopK * top, int k, int width) {
+  top->k = k;
+  top->width = width;
+  top->count = 0;
+  top->heap = malloc((k > 0 ? k : 1) * sizeof(Ranked));
+  top->values = malloc((size_t) (k > 0 ? k : 1) * width * sizeof(double));
+}
+
+void freeTop(TopK * top) {
+  free(top->heap);
+  free(top->values);
+}
+
+// whether a ranks below b
+int ranksBelow(const Ranked * a, const Ranked * b) {
+  return a->key < b->key || (a->key == b->key && a->line > b->line);
+}
+
+void siftDown(Ranked * heap, int count, int i) {
+
+  for (;;) {
+    int least = i, child = 2 * i + 1;
+    if (child < count && ranksBelow(&heap[child], &heap[least])) {
+      least = child;
+    }
+    if (child + 1 < count && ranksBelow(&heap[child + 1], &heap[least])) {
+      least = child + 1;
+    }
+    if (least == i) {
+      return;
+    }
+    Ranked swap = heap[i];
+    heap[i] = heap[least];
+    heap[least] = swap;
+    i = least;
+  }
+
+}
+
+void siftUp(Ranked * heap, int i) {
+
+  while (i > 0 && ranksBelow(&heap[i], &heap[(i - 1) / 2])) {
+    Ranked swap = heap[i];
+    heap[i] = heap[(i - 1) / 2];
+    heap[(i - 1) / 2] = swap;
+    i = (i - 1) / 2;
+  }
+
+}
+
+// keeps the row if it's among the best k so far
+void offerTop(TopK * top, double key, long long line, const double * values) {
+
+  Ranked entry = { key, line, top->count };
+
+  if (top->count < top->k) {
+    top->heap[top->count] = entry;
+    siftUp(top->heap, top->count++);
+  } else if (top->k > 0 && ranksBelow(&top->heap[0], &entry)) {
+    entry.slot = top->heap[0].slot;
+    top->heap[0] = entry;
+    siftDown(top->heap, top->count, 0);
+  } else {
+    return;
+  }
+  memcpy(&top->values[(size_t) entry.slot * top->width], values, top->width * sizeof(double));
+
+}
+
+// offers every row of from to top, with its lines moved down by base. from
+// is left empty.
+void mergeTop(TopK * top, TopK * from, long long base) {
+
+  int i;
+
+  for (i = 0; i < from->count; i++) {
+    const Ranked * entry = &from->heap[i];
+    offerTop(top, entry->key, base + entry->line, &from->values[(size_t) entry->slot * from->width]);
+  }
+  from->count = 0;
+
+}
+
+int compareRanked(const void * a, const void * b) {
+  return ranksBelow(b, a) ? -1 : ranksBelow(a, b) ? 1 : 0;
+}
+
+void printTop(TopK * top) {
+
+  int i, j;
+
+  qsort(top->heap, top->count, sizeof(Ranked), compareRanked);
+  for (i = 0; i < top->count; i++) {
+    const double * values = &top->values[(size_t) top->heap[i].slot * top->width];
+    printf("%lld", top->heap[i].line);
+    for (j = 0; j < top->width; j++) {
+      printf(" %.0f", values[j]);
+    }
+    printf("\n");
+  }
+  top->count = 0;
+
+}
+
+// ----- WHAT-IF ----------
+//
+// with --vary each price is followed by the prices the same house would have
+// with one attribute changed: --vary 2:1,-1 adds 1 to attribute 2, and then
+// takes 1 away; --vary 2=3,4 sets it to 3, and then to 4. --vary can be
+// repeated. the model is linear, so a change of d in attribute j moves the
+// price by d * w_j: the row's price is worked out once and each variant is
+// one add per row, never another dot product. the price used by --top,
+// --ref and so on is still the unchanged one.
+
+#define MAX_VARIANTS 256
+
+typedef struct {
+  int attribute, absolute;
+  double value;
+} Variant;
+
+typedef struct {
+  int count;
+  Variant variants[MAX_VARIANTS];
+} Sensitivity;
+
+// parses a --vary argument into more variants. returns 0, or -1 if it
+// isn't one.
+int parseVariants(const char * text, Sensitivity * sensitivity) {
+
+  char * rest;
+  int attribute = (int) strtol(text, &rest, 10);
+  int absolute = *rest == '=';
+
+  if (rest == text || attribute < 1 || (*rest != ':' && *rest != '=')) {
+    return -1;
+  }
+  do {
+    Variant * variant = &sensitivity->variants[sensitivity->count];
+    if (sensitivity->count == MAX_VARIANTS) {
+      return -1;
+    }
+    text = rest + 1;
+    variant->value = strtod(text, &rest);
+    if (rest == text || !isfinite(variant->value)) {
+      return -1;
+    }
+    variant->attribute = attribute;
+    variant->absolute = absolute;
+    sensitivity->count++;
+  } while (*rest == ',');
+
+  return *rest == '\0' ? 0 : -1;
+
+}
+
+// fills grid with each row's price followed by its variants. weights is
+// the (single) model, and row r's attributes are x[r][1..].
+void whatIf(const Sensitivity * sensitivity, double ** weights, double ** x, double ** y, double ** grid, int rows) {
+
+  int c, r;
+
+  for (r = 0; r < rows; r++) {
+    grid[r][0] = y[r][0];
+  }
+  for (c = 0; c < sensitivity->count; c++) {
+    const Variant * variant = &sensitivity->variants[c];
+    double w = weights[variant->attribute][0];
+    if (variant->absolute) {
+      for (r = 0; r < rows; r++) {
+        grid[r][c + 1] = y[r][0] + (variant->value - x[r][variant->attribute]) * w;
+      }
+    } else {
+      double shift = variant->value * w;
+      for (r = 0; r < rows; r++) {
+        grid[r][c + 1] = y[r][0] + shift;
+      }
+    }
+  }
+
+}
+
+// ----- SCORING ----------
+
+// turns a block of single-model predictions into price, lower and upper
+// bound columns of bounds. the standard error of the prediction for x is
+// sqrt(s^2 (1 + x^T (X^T X)^-1 x)), and x^T (X^T X)^-1 x = |L^-1 x|^2, so
+// the block only needs L Z = X^T solved for Z. with X^T laid out in
+// transposed (cols x BLOCK_ROWS) the forward substitution runs along whole
+// rows of it at once, like the GEMM that produced the prices.
+void intervalBounds(const Spread * spread, double ** estimator_x, double ** estimator_y,
+                    double ** transposed, double ** bounds, int rows, int cols) {
+
+    int i, k, r;
+    double ** lower = spread->lower;
+
+    transposed = transpose(estimator_x, transposed, rows, cols);
+
+    for (i = 0; i < cols; i++) {
+      double * z = transposed[i];
+      for (k = 0; k < i; k++) {
+        double l = lower[i][k];
+        const double * zk = transposed[k];
+        for (r = 0; r < rows; r++) {
+          z[r] -= l * zk[r];
+        }
+      }
+      // a column left out of the model adds nothing
+      double d = lower[i][i] != 0 ? 1 / lower[i][i] : 0;
+      for (r = 0; r < rows; r++) {
+        z[r] *= d;
+      }
+    }
+
+    for (r = 0; r < rows; r++) {
+      double leverage = 0;
+      for (i = 0; i < cols; i++) {
+        leverage += transposed[i][r] * transposed[i][r];
+      }
+      double margin = spread->z * sqrt(spread->variance * (1 + leverage));
+      bounds[r][0] = estimator_y[r][0];
+      bounds[r][1] = estimator_y[r][0] - margin;
+      bounds[r][2] = estimator_y[r][0] + margin;
+    }
+
+}
+
+// scores every row of the data file against all models. the weight vectors
+// are stacked as the columns of weights ((num_of_attributes + 1) x num_of_models),
+// so each block of rows costs one GEMM instead of one GEMV per model. with a
+// spread (one model only) each price is followed by its interval, and with
+// a sensitivity (one model only) by its variants; with
+// metrics every block is also checked against the reference. with an index
+// the rows are indexed as they are read. with a filter only the rows that
+// pass are scored, and are printed after their line numbers; with a top the
+// rows are offered to it instead of printed. line numbers are the reader's.
+// returns 0, or -1 once a malformed row has been reported.
+int predict(Reader * reader, double ** weights, int num_of_attributes, int num_of_houses, int num_of_models,
+            const Spread * spread, const Sensitivity * sensitivity, Metrics * metrics, RowIndex * index,
+            const Filter * filter, TopK * top) {
+
+    int i, rows, kept, done, status = 0;
+    long lines[BLOCK_ROWS];
+    unsigned char keep[BLOCK_ROWS];
+
+    double ** estimator_x = allocMatrix(BLOCK_ROWS, num_of_attributes + 1);
+    double ** estimator_y = allocMatrix(BLOCK_ROWS, num_of_models);
+    double ** transposed = spread != NULL ? allocMatrix(num_of_attributes + 1, BLOCK_ROWS) : NULL;
+    double ** bounds = spread != NULL ? allocMatrix(BLOCK_ROWS, 3) : NULL;
+    double ** grid = sensitivity != NULL ? allocMatrix(BLOCK_ROWS, sensitivity->count + 1) : NULL;
+    double ** printed = spread != NULL ? bounds : sensitivity != NULL ? grid : estimator_y;
+    int width = spread != NULL ? 3 : sensitivity != NULL ? sensitivity->count + 1 : num_of_models;
+
+    for (done = 0; done < num_of_houses && status == 0; done += rows) {
+      rows = num_of_houses - done < BLOCK_ROWS ? num_of_houses - done : BLOCK_ROWS;
+
+      for (i = 0; i < rows; i++) {
+        estimator_x[i][0] = 1;
+        if (index != NULL && (done + i) % INDEX_STRIDE == 0) {
+          addIndexEntry(index, done + i, readerOffset(reader), reader->line);
+        }
+        if (readRows(reader, &estimator_x[i][1], num_of_attributes, done + i, num_of_houses) < 0) {
+          status = -1;
+          rows = i;
+          break;
+        }
+        if (index != NULL) {
+          boundRow(index, &estimator_x[i][1]);
+        }
+        lines[i] = reader->line;
+      }
+
+      kept = rows;
+      if (filter != NULL) {
+        kept = keepRows(filter, estimator_x, rows, num_of_attributes + 1, keep);
+        packRows(estimator_x, lines, keep, rows, num_of_attributes + 1);
+      }
+
+      estimator_y = insertZeroes(estimator_y, kept, num_of_models);
+      estimator_y = multiply(estimator_x, weights, estimator_y, kept, num_of_models, num_of_attributes + 1);
+
+      if (spread != NULL) {
+        intervalBounds(spread, estimator_x, estimator_y, transposed, bounds, kept, num_of_attributes + 1);
+      }
+      if (sensitivity != NULL) {
+        whatIf(sensitivity, weights, estimator_x, estimator_y, grid, kept);
+      }
+      if (top != NULL) {
+        for (i = 0; i < kept; i++) {
+          offerTop(top, estimator_y[i][0], lines[i], printed[i]);
+        }
+      } else if (filter != NULL) {
+        printNumbered(lines, 0, printed, kept, width);
+      } else {
+        printPriceMatrix(printed, kept, width);
+      }
+      if (metrics != NULL && status == 0 && addMetrics(metrics, estimator_y[0], rows) != 0) {
+        status = -1;
+      }
+    }
+
+    if (status == 0) {
+      status = readEnd(reader, num_of_houses);
+    }
+    if (index != NULL) {
+      index->header.rows = num_of_houses;
+    }
+
+    freeMatrix(estimator_x);
+    freeMatrix(estimator_y);
+    freeMatrix(grid);
+    if (spread != NULL) {
+      freeMatrix(transposed);
+      freeMatrix(bounds);
+    }
+
+    return status;
+
+}
+
+// one thread's part of a data file: the rows whose lines start in
+// [start, end), scored and formatted into out, or ranked in top. when
+// indexing they're also indexed, by their row number within the part; lines
+// are counted within the part too. rows that pass a filter can only be
+// numbered once the part's first line is known, so they are kept in
+// numbered, each as its line and then its printed values.
+typedef struct {
+    const char * path;
+    long long start, end;
+    double ** weights;
+    int attributes, models;
+    const Spread * spread;
+    const Sensitivity * sensitivity;
+    long rows;
+    int status;
+    Buffer out;
+    Buffer prices;      // the unformatted predictions, when checking them
+    int keep_prices;
+    RowIndex entries;
+    int indexing;
+    TopK top;
+    int ranking;
+    long lines;
+    const Filter * filter;
+    Buffer numbered;
+} ScoreShard;
+
+void * scoreShard(void * arg) {
+
+    ScoreShard * shard = arg;
+    FILE * file = fopen(shard->path, "r");
+    Reader reader;
+    int i, j, rows, kept, status = 0, done = 0;
+    const Sensitivity * sensitivity = shard->sensitivity;
+    int width = shard->spread != NULL ? 3 : sensitivity != NULL ? sensitivity->count + 1 : shard->models;
+    long lines[BLOCK_ROWS];
+    unsigned char keep[BLOCK_ROWS];
+
+    if (file == NULL) {
+        perror(shard->path);
+        shard->status = -1;
+        return NULL;
+    }
+
+    double ** estimator_x = allocMatrix(BLOCK_ROWS, shard->attributes + 1);
+    double ** estimator_y = allocMatrix(BLOCK_ROWS, shard->models);
+    double ** transposed = shard->spread != NULL ? allocMatrix(shard->attributes + 1, BLOCK_ROWS) : NULL;
+    double ** bounds = shard->spread != NULL ? allocMatrix(BLOCK_ROWS, 3) : NULL;
+    double ** grid = sensitivity != NULL ? allocMatrix(BLOCK_ROWS, sensitivity->count + 1) : NULL;
+    double ** printed = shard->spread != NULL ? bounds : sensitivity != NULL ? grid : estimator_y;
+
+    initReader(&reader, file, shard->path);
+    if (seekReader(&reader, shard->start, shard->end) != 0) {
+        status = -1;
+        done = 1;
+    }
+
+    while (!done) {
+        for (rows = 0; rows < BLOCK_ROWS; rows++) {
+            estimator_x[rows][0] = 1;
+            if (shard->indexing && (shard->rows + rows) % INDEX_STRIDE == 0) {
+                addIndexEntry(&shard->entries, shard->rows + rows, readerOffset(&reader), reader.line);
+            }
+            status = readRow(&reader, &estimator_x[rows][1], shard->attributes);
+            if (status != 1) {
+                done = 1;
+                break;
+            }
+            if (shard->indexing) {
+                boundRow(&shard->entries, &estimator_x[rows][1]);
+            }
+            lines[rows] = reader.line;
+        }
+
+        kept = rows;
+        if (shard->filter != NULL) {
+            kept = keepRows(shard->filter, estimator_x, rows, shard->attributes + 1, keep);
+            packRows(estimator_x, lines, keep, rows, shard->attributes + 1);
+        }
+
+        estimator_y = insertZeroes(estimator_y, kept, shard->models);
+        estimator_y = multiply(estimator_x, shard->weights, estimator_y, kept, shard->models, shard->attributes + 1);
+        if (shard->spread != NULL) {
+            intervalBounds(shard->spread, estimator_x, estimator_y, transposed, bounds, kept, shard->attributes + 1);
+        }
+        if (sensitivity != NULL) {
+            whatIf(sensitivity, shard->weights, estimator_x, estimator_y, grid, kept);
+        }
+        if (shard->ranking) {
+            for (i = 0; i < kept; i++) {
+                offerTop(&shard->top, estimator_y[i][0], lines[i], printed[i]);
+            }
+        } else if (shard->filter != NULL) {
+            for (i = 0; i < kept; i++) {
+                double * values = (double *) reserveBuffer(&shard->numbered, (width + 1) * sizeof(double));
+                values[0] = lines[i];
+                for (j = 0; j < width; j++) {
+                    values[j + 1] = printed[i][j];
+                }
+            }
+        } else {
+            appendPrices(&shard->out, printed, kept, width);
+        }
+        if (shard->keep_prices) {
+            appendBuffer(&shard->prices, (const char *) estimator_y[0], rows * shard->models * sizeof(double));
+        }
+        shard->rows += rows;
+    }
+
+    shard->status = status < 0 ? -1 : 0;
+    shard->lines = reader.line;
+
+    freeMatrix(estimator_x);
+    freeMatrix(estimator_y);
+    freeMatrix(grid);
+    if (shard->spread != NULL) {
+        freeMatrix(transposed);
+        freeMatrix(bounds);
+    }
+    freeReader(&reader);
+    fclose(file);
+
+    return NULL;
+
+}
+
+// predict() spread over threads threads. the rows whose lines start in
+// [start, end) (end -1 for the end of the file) are taken in rounds of
+// threads * chunk bytes; each thread scores its chunk into a buffer and the
+// buffers are written in order, so output memory stays bounded by the round
+// and matches predict() exactly. metrics are taken in the same order, from
+// each chunk's raw predictions. chunks are cut at the rows of known, when
+// there is an index already; otherwise with an index to build, each thread
+// indexes its chunk and the entries are renumbered as the chunks are joined.
+// with a filter or a top, lines are numbered on from line, the number of
+// lines before start; each thread ranks its chunk and the rankings are
+// merged into top.
+int predictParallel(const char * path, long long start, long long end, long line, double ** weights,
+                    int num_of_attributes, int num_of_houses, int num_of_models, const Spread * spread,
+                    const Sensitivity * sensitivity, Metrics * metrics, int threads, size_t chunk,
+                    const RowIndex * known, RowIndex * index, const Filter * filter, TopK * top) {
+
+    struct stat st;
+    int t, j, status = 0;
+    int width = spread != NULL ? 3 : sensitivity != NULL ? sensitivity->count + 1 : num_of_models;
+    long rows = 0;
+    long long i;
+
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return -1;
+    }
+
+    ScoreShard * shards = calloc(threads, sizeof(ScoreShard));
+    pthread_t * ids = malloc(threads * sizeof(pthread_t));
+    long long size = end >= 0 && end < st.st_size ? end : st.st_size;
+
+    for (t = 0; t < threads; t++) {
+        initIndex(&shards[t].entries, num_of_attributes);
+        if (top != NULL) {
+            initTop(&shards[t].top, top->k, top->width);
+        }
+    }
+
+    while (start < size && status == 0) {
+        for (t = 0; t < threads; t++) {
+            ScoreShard * shard = &shards[t];
+            shard->path = path;
+            shard->start = start + (long long) chunk * t < size ? start + (long long) chunk * t : size;
+            shard->end = shard->start + (long long) chunk < size ? shard->start + (long long) chunk : size;
+            if (known != NULL) {
+                shard->start = t > 0 ? shards[t - 1].end : start;
+                shard->end = shard->end < size ? snapOffset(known, shard->end) : size;
+                shard->end = shard->end < size ? shard->end : size;
+            }
+            shard->entries.header.count = 0;
+            shard->indexing = index != NULL;
+            shard->ranking = top != NULL;
+            shard->filter = filter;
+            shard->numbered.len = 0;
+            shard->weights = weights;
+            shard->attributes = num_of_attributes;
+            shard->models = num_of_models;
+            shard->spread = spread;
+            shard->sensitivity = sensitivity;
+            shard->keep_prices = metrics != NULL;
+            shard->prices.len = 0;
+            shard->rows = 0;
+            shard->status = 0;
+            shard->out.len = 0;
+            pthread_create(&ids[t], NULL, scoreShard, shard);
+        }
+
+        for (t = 0; t < threads; t++) {
+            pthread_join(ids[t], NULL);
+        }
+
+        // stop at the first shard with a bad row, as predict() would
+        for (t = 0; t < threads && status == 0; t++) {
+            fwrite(shards[t].out.data, 1, shards[t].out.len, stdout);
+            for (i = 0; index != NULL && i < shards[t].entries.header.count; i++) {
+                const IndexEntry * entry = &shards[t].entries.entries[i];
+                memcpy(addIndexEntry(index, rows + entry->row, entry->offset, line + entry->line),
+                       &shards[t].entries.bounds[i * 2 * num_of_attributes], 2 * num_of_attributes * sizeof(double));
+            }
+            if (top != NULL) {
+                mergeTop(top, &shards[t].top, line);
+            }
+            for (i = 0; i < (long long) (shards[t].numbered.len / sizeof(double)); i += width + 1) {
+                const double * values = (const double *) shards[t].numbered.data + i;
+                printf("%ld", line + (long) values[0]);
+                for (j = 0; j < width; j++) {
+                    printf(" %.0f", values[j + 1]);
+                }
+                printf("\n");
+            }
+            rows += shards[t].rows;
+            line += shards[t].lines;
+            status = shards[t].status;
+            if (status == 0 && metrics != NULL && addMetrics(metrics, (const double *) shards[t].prices.data, shards[t].rows) != 0) {
+                status = -1;
+            }
+        }
+
+        start = known != NULL ? shards[threads - 1].end : start + (long long) chunk * threads;
+    }
+
+    if (status == 0 && rows != num_of_houses) {
+        fprintf(stderr, "%s: header promises %d rows, file has %ld\n", path, num_of_houses, rows);
+        status = -1;
+    }
+
+    if (index != NULL) {
+        index->header.rows = rows;
+    }
+
+    for (t = 0; t < threads; t++) {
+        free(shards[t].out.data);
+        free(shards[t].prices.data);
+        freeIndex(&shards[t].entries);
+        free(shards[t].numbered.data);
+        if (top != NULL) {
+            freeTop(&shards[t].top);
+        }
+    }
+    free(shards);
+    free(ids);
+
+    return status;
+
+}
+
+// predict() over just the stretches of rows that index says could pass
+// filter, with the rest of the file left unread. returns as predict() does.
+int predictMatching(Reader * reader, const RowIndex * index, double ** weights, int num_of_attributes,
+                    int num_of_models, const Spread * spread, const Sensitivity * sensitivity, const Filter * filter,
+                    TopK * top) {
+
+    long long i, j, count = index->header.count;
+    int status = 0;
+
+    for (i = 0; i < count && status == 0; i = j) {
+        for (j = i; j < count && boundsMatch(filter, &index->bounds[j * 2 * num_of_attributes], num_of_attributes); j++);
+        if (j == i) {
+            j++;
+            continue;
+        }
+
+        long long limit = j < count ? index->entries[j].offset : -1;
+        long long rows = (j < count ? index->entries[j].row : index->header.rows) - index->entries[i].row;
+        if (seekEntry(reader, &index->entries[i], limit) != 0) {
+            perror(reader->path);
+            return -1;
+        }
+        status = predict(reader, weights, num_of_attributes, (int) rows, num_of_models, spread, sensitivity, NULL, NULL,
+                         filter, top);
+    }
+
+    return status;
+
+}
+
+// ----- RESOURCES ----------
+//
+// how much the process may use. inside a container sysconf and /proc/meminfo
+// describe the host, so the cgroup limits (v2 or v1) on our own cgroup and
+// every ancestor are taken into account as well. the thread count, the size
+// of each thread's read buffer and the share of the file each thread takes
+// at a time all follow from these numbers.
+
+// no thread is given less than this much of a file; below it, the cost of
+// starting threads is more than the parsing they would save.
+#define MIN_SHARE (1 << 20)
+
+typedef struct {
+  long long memory;
+  const char * memory_source;
+  double cpus;
+  const char * cpu_source;
+  int threads;
+  size_t chunk_bytes;
+} Resources;
+
+// reads the first integer in a file such as a cgroup limit. returns -1 if the
+// file is missing or holds no number (cgroup v2 writes "max" for no limit).
+long long readLimit(const char * path) {
+
+  FILE * file = fopen(path, "r");
+  long long value;
+
+  if (file == NULL) {
+    return -1;
+  }
+  if (fscanf(file, "%lld", &value) != 1) {
+    value = -1;
+  }
+  fclose(file);
+
+  return value;
+
+}
+
+// finds this process's cgroup for a controller in /proc/self/cgroup. v2 is
+// the line "0::/path"; v1 lines name their controllers, e.g. "4:memory:/path".
+int cgroupPath(const char * controller, char * path, size_t size) {
+
+  FILE * file = fopen("/proc/self/cgroup", "r");
+  char line[4096];
+  int found = 0;
+
+  if (file == NULL) {
+    return 0;
+  }
+
+  while (!found && fgets(line, sizeof(line), file) != NULL) {
+    char * controllers = strchr(line, ':');
+    char * group = controllers != NULL ? strchr(controllers + 1, ':') : NULL;
+    if (group == NULL) {
+      continue;
+    }
+    *group++ = '\0';
+    controllers++;
+    group[strcspn(group, "\n")] = '\0';
+
+    if (controller == NULL ? *controllers == '\0' : strstr(controllers, controller) != NULL) {
+      snprintf(path, size, "%s", group);
+      found = 1;
+    }
+  }
+  fclose(file);
+
+  return found;
+
+}
+
+// each probe reads one limit from a cgroup directory, or returns -1 if that
+// directory doesn't set one.
+typedef double (*CgroupProbe)(const char * dir);
+
+double memoryHeadroom(const char * dir, const char * limit_file, const char * usage_file) {
+
+  char path[4200];
+  long long limit, usage;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, limit_file);
+  limit = readLimit(path);
+  snprintf(path, sizeof(path), "%s/%s", dir, usage_file);
+  usage = readLimit(path);
+
+  // v1 reports "no limit" as a huge page-rounded number
+  if (limit < 0 || limit >= (1LL << 60)) {
+    return -1;
+  }
+  return limit > usage ? (double) (limit - (usage > 0 ? usage : 0)) : 0;
+
+}
+
+double memoryV2(const char * dir) {
+  return memoryHeadroom(dir, "memory.max", "memory.current");
+}
+
+double memoryV1(const char * dir) {
+  return memoryHeadroom(dir, "memory.limit_in_bytes", "memory.usage_in_bytes");
+}
+
+// cpu.max holds "quota period", or "max period" when unthrottled
+double cpuV2(const char * dir) {
+
+  char path[4200], quota[32];
+  long long period;
+  double cpus = -1;
+  FILE * file;
+
+  snprintf(path, sizeof(path), "%s/cpu.max", dir);
+  file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+  if (fscanf(file, "%31s %lld", quota, &period) == 2 && strcmp(quota, "max") != 0 && period > 0) {
+    cpus = atof(quota) / period;
+  }
+  fclose(file);
+
+  return cpus;
+
+}
+
+// cpu.cfs_quota_us is -1 when unthrottled
+double cpuV1(const char * dir) {
+
+  char path[4200];
+  long long quota, period;
+
+  snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+  quota = readLimit(path);
+  snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+  period = readLimit(path);
+
+  return quota > 0 && period > 0 ? (double) quota / period : -1;
+
+}
+
+// the tightest limit a probe finds on a cgroup and its ancestors, or -1 if
+// none of them sets one. mount is where the hierarchy is mounted.
+double cgroupLimit(const char * mount, const char * group, CgroupProbe probe) {
+
+  char dir[4096];
+  double best = -1;
+  int len = snprintf(dir, sizeof(dir), "%s%s", mount, strcmp(group, "/") == 0 ? "" : group);
+
+  // a path that doesn't fit would probe some other group
+  if (len < 0 || (size_t) len >= sizeof(dir)) {
+    return -1;
+  }
+
+  for (;;) {
+    double limit = probe(dir);
+    if (limit >= 0 && (best < 0 || limit < best)) {
+      best = limit;
+    }
+
+    char * slash = strrchr(dir, '/');
+    if (slash == NULL || (size_t) (slash - dir) < strlen(mount)) {
+      break;
+    }
+    *slash = '\0';
+  }
+
+  return best;
+
+}
+
+void detectResources(Resources * resources, int threads) {
+
+  char group[4096];
+  char line[256];
+  long long memory = -1, available;
+  double limit, cpus;
+  FILE * file;
+
+  // what the host can give us
+  resources->memory_source = "physical memory";
+  file = fopen("/proc/meminfo", "r");
+  if (file != NULL) {
+    while (fgets(line, sizeof(line), file) != NULL) {
+      if (sscanf(line, "MemAvailable: %lld kB", &available) == 1) {
+        memory = available * 1024;
+        resources->memory_source = "MemAvailable";
+      }
+    }
+    fclose(file);
+  }
+  if (memory < 0) {
+    memory = (long long) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+  }
+
+  cpus = (double) sysconf(_SC_NPROCESSORS_ONLN);
+  resources->cpu_source = "online cpus";
+#ifdef __linux__
+  cpu_set_t affinity;
+  if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0 && CPU_COUNT(&affinity) < cpus) {
+    cpus = CPU_COUNT(&affinity);
+    resources->cpu_source = "cpu affinity";
+  }
+#endif
+
+  // what our cgroup lets us have
+  if (cgroupPath(NULL, group, sizeof(group))) {
+    limit = cgroupLimit("/sys/fs/cgroup", group, memoryV2);
+    if (limit >= 0 && limit < memory) {
+      memory = (long long) limit;
+      resources->memory_source = "cgroup v2 limit";
+    }
+    limit = cgroupLimit("/sys/fs/cgroup", group, cpuV2);
+    if (limit > 0 && limit < cpus) {
+      cpus = limit;
+      resources->cpu_source = "cgroup v2 quota";
+    }
+  }
+  if (cgroupPath("memory", group, sizeof(group))) {
+    limit = cgroupLimit("/sys/fs/cgroup/memory", group, memoryV1);
+    if (limit >= 0 && limit < memory) {
+      memory = (long long) limit;
+      resources->memory_source = "cgroup v1 limit";
+    }
+  }
+  if (cgroupPath("cpu", group, sizeof(group))) {
+    limit = cgroupLimit("/sys/fs/cgroup/cpu", group, cpuV1);
+    if (limit > 0 && limit < cpus) {
+      cpus = limit;
+      resources->cpu_source = "cgroup v1 quota";
+    }
+  }
+
+  resources->memory = memory;
+  resources->cpus = cpus;
+
+  // a quota of 1.5 cpus still gets two threads; rounding down would leave
+  // half a cpu unused, and the scheduler smooths out the rest
+  if (threads > 0) {
+    resources->threads = threads;
+    resources->cpu_source = "--threads";
+  } else {
+    resources->threads = (int) (cpus + 0.5) > 0 ? (int) (cpus + 0.5) : 1;
+  }
+
+  // each thread reads through its own buffer and takes this much of a file
+  // at a time; keep all of them within a quarter of the memory we may use
+  long long share = memory / 4 / resources->threads;
+  if (share > 16 * MIN_SHARE) {
+    share = 16 * MIN_SHARE;
+  }
+  if (share < READ_CHUNK) {
+    share = READ_CHUNK;
+  }
+  resources->chunk_bytes = (size_t) share;
+
+}
+
+// threads worth starting for bytes of input
+int threadsFor(const Resources * resources, double bytes) {
+
+  int threads = resources->threads;
+
+  if (bytes / MIN_SHARE < threads) {
+    threads = (int) (bytes / MIN_SHARE);
+  }
+
+  return threads > 1 ? threads : 1;
+
+}
+
+// ----- PLANNING ----------
+//
+// the plan is worked out from the file headers alone, before any row is read,
+// and decides how the training rows are held:
+//
+//   in-core      X is held as compact typed columns and (X^T X)^-1 X^T Y
+//                formed from it. O(houses * attributes) memory; the
+//                original arithmetic.
+//   streaming    rows are folded into X^T X and X^T Y as they are parsed.
+//                O(attributes^2) memory.
+//   out-of-core  streaming, with the matrices spilled to a temporary file
+//                for when even O(attributes^2) doesn't fit.
+//
+// scoring always streams the data file in blocks of BLOCK_ROWS.
+
+typedef struct {
+  const char * path;
+  int attributes, houses, files;
+  double bytes;
+} InputInfo;
+
+typedef struct {
+  double memory, flops, io, disk;
+} Cost;
+
+// reads just the header of an input file. returns 0 on success.
+int peekHeader(const char * path, InputInfo * info) {
+
+  FILE * file = fopen(path, "r");
+  struct stat st;
+  Reader reader;
+  GramHeader gram;
+  char kind[16];
+  int status;
+
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  if (readGramHeader(file, &gram)) {
+    info->attributes = (int) gram.attributes;
+    info->houses = gram.houses < 0x7fffffff ? (int) gram.houses : 0x7fffffff;
+    status = 0;
+  } else {
+    initReader(&reader, file, path);
+    status = readHeader(&reader, kind, sizeof(kind), &info->attributes, &info->houses);
+    freeReader(&reader);
+  }
+
+  info->path = path;
+  info->files = 1;
+  info->bytes = fstat(fileno(file), &st) == 0 ? (double) st.st_size : 0;
+  fclose(file);
+
+  return status;
+
+}
+
+// peekHeader() for all of a model's training files: the houses and bytes are
+// their totals. returns 0 on success.
+int peekFiles(const FileList * files, InputInfo * info) {
+
+  InputInfo one;
+  int i;
+
+  if (peekHeader(files->paths[0], info) != 0) {
+    return -1;
+  }
+  for (i = 1; i < files->count; i++) {
+    if (peekHeader(files->paths[i], &one) != 0) {
+      return -1;
+    }
+    if (one.attributes != info->attributes) {
+      fprintf(stderr, "%s: %d attributes where %s has %d\n", one.path, one.attributes, info->path, info->attributes);
+      return -1;
+    }
+    info->houses = (long long) info->houses + one.houses < 0x7fffffffL ? info->houses + one.houses : 0x7fffffff;
+    info->bytes += one.bytes;
+    info->files++;
+  }
+
+  return 0;
+
+}
+
+// costs of training every model and scoring the data with each strategy.
+// models are trained one after another, so memory is the largest model's.
+// every thread parsing a file has its own read buffer, and when streaming its
+// own partial X^T X; when scoring, its own block and a chunk of output text.
+void estimateCosts(const InputInfo * models, int num_of_models, const InputInfo * data,
+                   const Resources * resources, Cost * costs) {
+
+  int i, mode;
+  double p = data->attributes + 1;
+  double m = num_of_models;
+  double d = data->houses;
+
+  // scoring: the stacked weights, then per thread a block of rows and their
+  // predictions, a read buffer and (when threaded) a chunk of output text.
+  // about eight bytes of text are written per prediction
+  double score_threads = threadsFor(resources, data->bytes);
+  double score_memory = 8 * p * m + score_threads * (8 * BLOCK_ROWS * (p + m) + READ_CHUNK);
+  double score_flops = 2 * d * p * m;
+  double score_io = data->bytes + 8 * d * m;
+
+  if (score_threads > 1) {
+    score_memory += score_threads * (double) resources->chunk_bytes;
+  }
+
+  // Gauss-Jordan in inverse() sweeps both the matrix and the identity
+  double solve_flops = 4 * p * p * p;
+
+  for (mode = MODE_INCORE; mode <= MODE_OOC; mode++) {
+    Cost * cost = &costs[mode];
+    cost->memory = 0;
+    cost->flops = score_flops;
+    cost->io = score_io;
+    cost->disk = 0;
+
+    for (i = 0; i < num_of_models; i++) {
+      double n = models[i].houses;
+      double threads = mode == MODE_INCORE ? 1 : threadsFor(resources, models[i].bytes);
+      double buffers = threads * READ_CHUNK;
+      double matrices, memory;
+
+      if (mode == MODE_INCORE) {
+        // X's attribute columns at up to eight bytes a value, Y, X^T X and
+        // its inverse, the weights and a block of X^T. only the upper half
+        // of X^T X is summed
+        matrices = 8 * (n * (p - 1) + n + 2 * p * p + p + (p + 1) * BLOCK_ROWS);
+        cost->flops += n * p * (p + 1) + solve_flops + 2 * p * p * n + 2 * p * n;
+      } else {
+        // X^T X and its inverse, X^T Y and the weights, plus a partial
+        // X^T X and X^T Y per range of a file and per file
+        double ranges = rangesFor(models[i].bytes / models[i].files, (int) p);
+        double partials = (ranges > 1 ? ranges : 0) + (models[i].files > 1 ? models[i].files : 0);
+        matrices = 8 * (2 * p * p + 2 * p) + partials * 8 * (p * p + p);
+        cost->flops += n * (p * p + p) + 2 * n * p + solve_flops + 2 * p * p;
+      }
+
+      if (mode == MODE_OOC) {
+        // the matrices live in the spill file, written once and swept by
+        // the p pivots of the inverse. X^T Y and the weights are small
+        // enough to stay on the heap (spillThreshold()) and are counted
+        // with them only for simplicity
+        cost->disk = matrices > cost->disk ? matrices : cost->disk;
+        cost->io += models[i].bytes + matrices * (1 + p);
+        memory = buffers + 8 * 2 * p;
+      } else {
+        cost->io += models[i].bytes;
+        memory = matrices + buffers;
+      }
+
+      if (memory > cost->memory) {
+        cost->memory = memory;
+      }
+    }
+
+    cost->memory += score_memory;
+  }
+
+}
+
+// the first strategy, in order of preference, that fits in memory
+int choosePlan(const Cost * costs, long long budget) {
+
+  int mode;
+
+  for (mode = MODE_INCORE; mode < MODE_OOC; mode++) {
+    if (costs[mode].memory <= (double) budget) {
+      return mode;
+    }
+  }
+
+  return MODE_OOC;
+
+}
+
+void formatBytes(double bytes, char * buf, size_t size) {
+
+  static const char * units[] = { "B", "KiB", "MiB", "GiB", "TiB", "PiB" };
+  int unit = 0;
+
+  while (bytes >= 1024 && unit < 5) {
+    bytes /= 1024;
+    unit++;
+  }
+  snprintf(buf, size, unit == 0 ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+
+}
+
+void printPlan(const InputInfo * models, int num_of_models, const InputInfo * data,
+               const Resources * resources, const Cost * costs, int chosen, int forced) {
+
+  char memory[32], io[32], disk[32];
+  int i, mode;
+
+  printf("plan\n");
+  for (i = 0; i < num_of_models; i++) {
+    if (models[i].files > 1) {
+      printf("  training     %s and %d more files: %d rows x %d attributes\n", models[i].path, models[i].files - 1,
+             models[i].houses, models[i].attributes);
+    } else {
+      printf("  training     %s: %d rows x %d attributes\n", models[i].path, models[i].houses, models[i].attributes);
+    }
+  }
+  printf("  data         %s: %d rows x %d attributes\n", data->path, data->houses, data->attributes);
+  formatBytes((double) resources->memory, memory, sizeof(memory));
+  printf("  memory       %s available (%s)\n", memory, resources->memory_source);
+  formatBytes((double) resources->chunk_bytes, io, sizeof(io));
+  printf("  cpus         %.2g (%s), %d threads, %s per thread per round\n",
+         resources->cpus, resources->cpu_source, resources->threads, io);
+  printf("\n");
+  printf("  %-12s %12s %12s %12s %12s\n", "strategy", "memory", "flops", "i/o", "temp disk");
+
+  for (mode = MODE_INCORE; mode <= MODE_OOC; mode++) {
+    formatBytes(costs[mode].memory, memory, sizeof(memory));
+    formatBytes(costs[mode].io, io, sizeof(io));
+    formatBytes(costs[mode].disk, disk, sizeof(disk));
+    printf("%c %-12s %12s %12.3g %12s %12s\n", mode == chosen ? '*' : ' ',
+           mode_names[mode], memory, costs[mode].flops, io, disk);
+  }
+
+  printf("\n");
+  printf("  chosen       %s%s\n", mode_names[chosen], forced ? " (forced by --mode)" : "");
+
+}
+
+// ----- GROUP-BY ----------
+//
+// with --key the first token of every row, in the training and data files
+// alike, names the row's group (a metro, a zip code), and a model is fitted
+// per group in a single pass: each row is folded into its group's X^T X and
+// X^T Y, found through a hash table keyed on the token. threads take byte
+// ranges of the file as in accumulateParallel, each with its own table, and
+// the tables are merged in range order so groups keep the order in which
+// they first appear. a group with fewer rows than weights, or whose X^T X
+// isn't positive definite, is scored with the pooled model fitted to every
+// row, as are data rows whose key never appeared in training.
+//
+// there may be millions of small groups, so group state is carved out of an
+// arena instead of malloc'd per group, X^T X is kept as its upper triangle
+// only, and every thread's table is held to its share of the memory budget.
+
+#define ARENA_BLOCK (1 << 20)
+
+typedef struct ArenaBlock {
+  struct ArenaBlock * next;
+  size_t used, size;
+  double data[];
+} ArenaBlock;
+
+typedef struct {
+  ArenaBlock * head;
+  size_t bytes;
+} Arena;
+
+// size bytes from the arena, aligned for doubles and zeroed
+void * arenaAlloc(Arena * arena, size_t size) {
+
+  ArenaBlock * block = arena->head;
+
+  size = (size + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+  if (block == NULL || block->used + size > block->size) {
+    size_t capacity = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+    block = calloc(1, sizeof(ArenaBlock) + capacity);
+    block->size = capacity;
+    block->next = arena->head;
+    arena->head = block;
+    arena->bytes += sizeof(ArenaBlock) + capacity;
+  }
+
+  void * p = (char *) block->data + block->used;
+  block->used += size;
+
+  return p;
+
+}
+
+void freeArena(Arena * arena) {
+
+  ArenaBlock * block, * next;
+
+  for (block = arena->head; block != NULL; block = next) {
+    next = block->next;
+    free(block);
+  }
+  arena->head = NULL;
+  arena->bytes = 0;
+
+}
+
+typedef struct {
+  const char * key;
+  size_t len;
+  unsigned long long hash;
+  long rows;
+  double * sums;      // upper triangle of X^T X by rows, then X^T Y
+  double * weights;   // after solving: into sums, or the pooled model
+} Group;
+
+// open addressing with linear probing. slots hold an index into groups plus
+// one, so 0 is free; groups is kept in order of first appearance.
+typedef struct {
+  int * slots;
+  size_t capacity;
+  Group * groups;
+  size_t count, size;
+  int cols;
+  Arena arena;
+} GroupTable;
+
+// doubles of state per group
+size_t groupSums(int cols) {
+  return (size_t) cols * (cols + 1) / 2 + cols;
+}
+
+// FNV-1a
+unsigned long long hashKey(const char * key, size_t len) {
+
+  unsigned long long hash = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hash = (hash ^ (unsigned char) key[i]) * 1099511628211ULL;
+  }
+
+  return hash;
+
+}
+
+void initGroups(GroupTable * table, int cols) {
+
+  memset(table, 0, sizeof(GroupTable));
+  table->cols = cols;
+  table->capacity = 1024;
+  table->slots = calloc(table->capacity, sizeof(int));
+
+}
+
+void freeGroups(GroupTable * table) {
+
+  free(table->slots);
+  free(table->groups);
+  freeArena(&table->arena);
+
+}
+
+// everything the table holds
+double groupBytes(const GroupTable * table) {
+  return (double) table->capacity * sizeof(int) + (double) table->size * sizeof(Group) + table->arena.bytes;
+}
+
+// finds the group for a key. if it isn't there and insert is set it is added,
+// with the key copied into the arena; otherwise returns NULL.
+Group * findGroup(GroupTable * table, const char * key, size_t len, unsigned long long hash, int insert) {
+
+  size_t mask = table->capacity - 1;
+  size_t i;
+
+  for (i = hash & mask; table->slots[i] != 0; i = (i + 1) & mask) {
+    Group * group = &table->groups[table->slots[i] - 1];
+    if (group->hash == hash && group->len == len && memcmp(group->key, key, len) == 0) {
+      return group;
+    }
+  }
+  if (!insert) {
+    return NULL;
+  }
+
+  // keep the table at most half full
+  if (2 * (table->count + 1) > table->capacity) {
+    free(table->slots);
+    table->capacity *= 2;
+    table->slots = calloc(table->capacity, sizeof(int));
+    mask = table->capacity - 1;
+    for (i = 0; i < table->count; i++) {
+      size_t s;
+      for (s = table->groups[i].hash & mask; table->slots[s] != 0; s = (s + 1) & mask);
+      table->slots[s] = (int) i + 1;
+    }
+    for (i = hash & mask; table->slots[i] != 0; i = (i + 1) & mask);
+  }
+  if (table->count == table->size) {
+    table->size = table->size > 0 ? table->size * 2 : 1024;
+    table->groups = realloc(table->groups, table->size * sizeof(Group));
+  }
+
+  size_t sums = groupSums(table->cols);
+  Group * group = &table->groups[table->count];
+  group->sums = arenaAlloc(&table->arena, sums * sizeof(double) + len);
+  group->key = memcpy(group->sums + sums, key, len);
+  group->len = len;
+  group->hash = hash;
+  group->rows = 0;
+  group->weights = NULL;
+  table->slots[i] = (int) ++table->count;
+
+  return group;
+
+}
+
+// adds a row laid out as accumulateRow() expects to a group's packed sums
+void accumulateGroup(Group * group, const double * row, int cols) {
+
+  double * sums = group->sums;
+  double * product_y = sums + (size_t) cols * (cols + 1) / 2;
+  double y = row[cols];
+  int a, c;
+
+  for (a = 0; a < cols; a++) {
+    double f = row[a];
+    for (c = a; c < cols; c++) {
+      *sums++ += f * row[c];
+    }
+    product_y[a] += f * y;
+  }
+  group->rows++;
+
+}
+
+// one range of a keyed training file, summed into its own table
+typedef struct {
+  const char * path;
+  long long start, end;
+  int cols;
+  double budget;
+  GroupTable table;
+  long rows;
+  int status;
+} GroupShard;
+
+void * groupShard(void * arg) {
+
+  GroupShard * shard = arg;
+  FILE * file = fopen(shard->path, "r");
+  Reader reader;
+  char * key;
+  size_t len;
+  int status;
+
+  initGroups(&shard->table, shard->cols);
+  if (file == NULL) {
+    perror(shard->path);
+    shard->status = -1;
+    return NULL;
+  }
+
+  double * row = malloc((shard->cols + 1) * sizeof(double));
+  row[0] = 1;
+
+  initReader(&reader, file, shard->path);
+  status = seekReader(&reader, shard->start, shard->end);
+  while (status == 0 && (status = readKeyedRow(&reader, &key, &len, &row[1], shard->cols)) > 0) {
+    size_t count = shard->table.count;
+    Group * group = findGroup(&shard->table, key, len, hashKey(key, len), 1);
+    accumulateGroup(group, row, shard->cols);
+    shard->rows++;
+    status = 0;
+    if (shard->table.count != count && groupBytes(&shard->table) > shard->budget) {
+      char need[32];
+      formatBytes(shard->budget, need, sizeof(need));
+      fprintf(stderr, "%s: more than %s of group state after %zu groups\n",
+              shard->path, need, shard->table.count);
+      status = -1;
+    }
+  }
+  shard->status = status < 0 ? -1 : 0;
+
+  free(row);
+  freeReader(&reader);
+  fclose(file);
+
+  return NULL;
+
+}
+
+typedef struct {
+  GroupShard * shards;
+  int count, first, step;
+} GroupWorker;
+
+void * groupShards(void * arg) {
+
+  GroupWorker * worker = arg;
+  int i;
+
+  for (i = worker->first; i < worker->count; i += worker->step) {
+    groupShard(&worker->shards[i]);
+  }
+
+  return NULL;
+
+}
+
+// folds every group of from into table, in from's order
+void mergeGroups(GroupTable * table, const GroupTable * from) {
+
+  size_t i, s, sums = groupSums(table->cols);
+
+  for (i = 0; i < from->count; i++) {
+    const Group * other = &from->groups[i];
+    Group * group = findGroup(table, other->key, other->len, other->hash, 1);
+    for (s = 0; s < sums; s++) {
+      group->sums[s] += other->sums[s];
+    }
+    group->rows += other->rows;
+  }
+
+}
+
+// reads the groups of a keyed training file into table (initialized here).
+// like accumulateParallel(), the file is cut into rangesFor() ranges taken
+// in turn by up to threads threads, and their tables are merged in range
+// order, so the sums don't depend on the number of threads. every range's
+// table is kept until then, so each gets an equal share of the memory.
+// returns 0, or -1 once a problem has been reported.
+int accumulateGroups(const char * path, int cols, int num_of_houses, const Resources * resources,
+                     int threads, GroupTable * table) {
+
+  FILE * file = fopen(path, "r");
+  struct stat st;
+  Reader reader;
+  char kind[16];
+  int i, t, attributes, houses, status = 0;
+  long rows = 0;
+
+  if (file == NULL) {
+    perror(path);
+    initGroups(table, cols);
+    return -1;
+  }
+  initReader(&reader, file, path);
+  status = readHeader(&reader, kind, sizeof(kind), &attributes, &houses);
+  long long start = readerOffset(&reader);
+  freeReader(&reader);
+  if (status == 0 && fstat(fileno(file), &st) != 0) {
+    perror(path);
+    status = -1;
+  }
+  fclose(file);
+  if (status != 0) {
+    initGroups(table, cols);
+    return -1;
+  }
+
+  long long span = (long long) st.st_size - start;
+  int ranges = rangesFor((double) span, cols);
+  int workers = threads < ranges ? threads : ranges;
+
+  workers = workers > 0 ? workers : 1;
+  GroupShard * shards = calloc(ranges, sizeof(GroupShard));
+  GroupWorker * pool = malloc(workers * sizeof(GroupWorker));
+  pthread_t * ids = malloc(workers * sizeof(pthread_t));
+
+  for (i = 0; i < ranges; i++) {
+    shards[i].path = path;
+    shards[i].start = start + span * i / ranges;
+    shards[i].end = start + span * (i + 1) / ranges;
+    shards[i].cols = cols;
+    shards[i].budget = (double) resources->memory / ranges;
+  }
+
+  for (t = 0; t < workers; t++) {
+    pool[t].shards = shards;
+    pool[t].count = ranges;
+    pool[t].first = t;
+    pool[t].step = workers;
+    if (t > 0) {
+      pthread_create(&ids[t], NULL, groupShards, &pool[t]);
+    }
+  }
+  groupShards(&pool[0]);
+  for (t = 1; t < workers; t++) {
+    pthread_join(ids[t], NULL);
+  }
+
+  for (i = 0; i < ranges; i++) {
+    if (shards[i].status != 0) {
+      status = -1;
+    }
+    rows += shards[i].rows;
+  }
+
+  // the first range's table takes in the rest
+  *table = shards[0].table;
+  for (i = 1; i < ranges; i++) {
+    if (status == 0) {
+      mergeGroups(table, &shards[i].table);
+    }
+    freeGroups(&shards[i].table);
+  }
+
+  if (status == 0 && rows != num_of_houses) {
+    fprintf(stderr, "%s: header promises %d rows, file has %ld\n", path, num_of_houses, rows);
+    status = -1;
+  }
+
+  free(shards);
+  free(pool);
+  free(ids);
+
+  return status;
+
+}
+
+// unpacks a group's sums into the full X^T X and X^T Y
+void unpackGroup(const double * sums, int cols, double ** product_x, double * product_y) {
+
+  int a, c;
+
+  for (a = 0; a < cols; a++) {
+    for (c = a; c < cols; c++) {
+      product_x[a][c] = product_x[c][a] = *sums++;
+    }
+  }
+  memcpy(product_y, sums, cols * sizeof(double));
+
+}
+
+// solves every group in place, pointing the ones that can't be solved at
+// pooled, which is fitted to the sum of all of them. groups are solved
+// BATCH_LANES at a time with choleskyBatch(); their packed sums are already
+// in its layout, one lane each. returns the number of groups that fell back,
+// or -1 if not even the pooled model can be solved.
+long solveGroups(GroupTable * table, double * pooled) {
+
+  int cols = table->cols;
+  size_t i, s, sums = groupSums(cols), tri = sums - cols;
+  long fallback = 0;
+  int l, lanes, ok[BATCH_LANES];
+
+  double ** product_x = allocMatrix(cols, cols);
+  double ** lower = allocMatrix(cols, cols);
+  double * total = calloc(sums, sizeof(double));
+  double * upper = malloc(tri * BATCH_LANES * sizeof(double));
+  double * rhs = malloc(cols * BATCH_LANES * sizeof(double));
+
+  for (i = 0; i < table->count; i++) {
+    for (s = 0; s < sums; s++) {
+      total[s] += table->groups[i].sums[s];
+    }
+  }
+  unpackGroup(total, cols, product_x, pooled);
+  if (choleskyIndependent(product_x, lower, cols, "pooled model") < 0) {
+    fprintf(stderr, "pooled model: X^T X can't be factored\n");
+    fallback = -1;
+  } else {
+    choleskySolve(lower, pooled, cols);
+  }
+
+  for (i = 0; i < table->count && fallback >= 0; i += BATCH_LANES) {
+    lanes = table->count - i < BATCH_LANES ? (int) (table->count - i) : BATCH_LANES;
+    for (l = 0; l < BATCH_LANES; l++) {
+      if (l < lanes) {
+        const double * group = table->groups[i + l].sums;
+        for (s = 0; s < tri; s++) {
+          upper[s * BATCH_LANES + l] = group[s];
+        }
+        for (s = 0; s < (size_t) cols; s++) {
+          rhs[s * BATCH_LANES + l] = group[tri + s];
+        }
+        ok[l] = table->groups[i + l].rows >= cols;
+      } else {
+        // a short last batch is padded out with identity systems
+        for (s = 0; s < tri; s++) {
+          upper[s * BATCH_LANES + l] = 0;
+        }
+        for (s = 0; s < (size_t) cols; s++) {
+          upper[PACKED(s, s, (size_t) cols) * BATCH_LANES + l] = 1;
+          rhs[s * BATCH_LANES + l] = 0;
+        }
+        ok[l] = 1;
+      }
+    }
+
+    choleskyBatch(upper, rhs, cols, ok);
+
+    // the weights take the place of the sums they were solved from
+    for (l = 0; l < lanes; l++) {
+      Group * group = &table->groups[i + l];
+      if (ok[l]) {
+        for (s = 0; s < (size_t) cols; s++) {
+          group->sums[s] = rhs[s * BATCH_LANES + l];
+        }
+        group->weights = group->sums;
+      } else {
+        group->weights = pooled;
+        fallback++;
+      }
+    }
+  }
+
+  freeMatrix(product_x);
+  freeMatrix(lower);
+  free(total);
+  free(upper);
+  free(rhs);
+
+  return fallback;
+
+}
+
+// scores each row of a keyed data file with its group's model, in order.
+// returns 0, or -1 once a problem has been reported.
+int predictGroups(Reader * reader, GroupTable * table, const double * pooled, int num_of_houses, Metrics * metrics) {
+
+  int i, a, cols = table->cols;
+  char * key;
+  size_t len;
+  int status = 0;
+
+  double * row = malloc(cols * sizeof(double));
+
+  for (i = 0; i < num_of_houses; i++) {
+    status = readKeyedRow(reader, &key, &len, row, cols - 1);
+    if (status <= 0) {
+      if (status == 0) {
+        fprintf(stderr, "%s: header promises %d rows, file has %d\n", reader->path, num_of_houses, i);
+      }
+      status = -1;
+      break;
+    }
+
+    Group * group = findGroup(table, key, len, hashKey(key, len), 0);
+    const double * w = group != NULL ? group->weights : pooled;
+    double price = w[0];
+    for (a = 1; a < cols; a++) {
+      price += w[a] * row[a - 1];
+    }
+    printf("%.0f\n", price);
+    status = 0;
+    if (metrics != NULL && addMetrics(metrics, &price, 1) != 0) {
+      status = -1;
+      break;
+    }
+  }
+
+  if (status == 0) {
+    status = readEnd(reader, num_of_houses);
+  }
+
+  free(row);
+
+  return status;
+
+}
+
+// fits a model per key of the training file and scores the data file with
+// them. returns 0, or -1 once a problem has been reported.
+int groupBy(const InputInfo * train_info, const InputInfo * data_info, const Resources * resources,
+            Metrics * metrics) {
+
+  int cols = train_info->attributes + 1;
+  GroupTable table;
+  char bytes[32];
+
+  int status = accumulateGroups(train_info->path, cols, train_info->houses, resources,
+                                threadsFor(resources, train_info->bytes), &table);
+  double * pooled = malloc(cols * sizeof(double));
+  long fallback = status == 0 ? solveGroups(&table, pooled) : -1;
+
+  if (fallback >= 0) {
+    formatBytes(groupBytes(&table), bytes, sizeof(bytes));
+    fprintf(stderr, "%zu groups, %ld scored with the pooled model, %s of group state\n",
+            table.count, fallback, bytes);
+
+    FILE * file = fopen(data_info->path, "r");
+    if (file == NULL) {
+      perror(data_info->path);
+      status = -1;
+    } else {
+      Reader reader;
+      char kind[16];
+      int attributes, houses;
+
+      initReader(&reader, file, data_info->path);
+      status = readHeader(&reader, kind, sizeof(kind), &attributes, &houses);
+      if (status == 0) {
+        status = predictGroups(&reader, &table, pooled, houses, metrics);
+      }
+      freeReader(&reader);
+      fclose(file);
+    }
+  } else {
+    status = -1;
+  }
+
+  free(pooled);
+  freeGroups(&table);
+
+  return status;
+
+}
+
+// ----- SERVING ----------
+//
+// with --serve port (TCP on 127.0.0.1) and/or --socket path (a Unix socket)
+// the trained models stay in memory and rows are scored on request. there is
+// a worker thread per cpu, each with its own epoll loop over its own
+// connections, so nothing on the request path is shared except the weights,
+// which are only read. every worker has its own TCP listener on the port,
+// bound with SO_REUSEPORT so the kernel spreads connections across them.
+// Unix sockets can't be spread that way, so the workers all wait on the one
+// Unix listener with EPOLLEXCLUSIVE, which wakes one of them at a time.
+//
+// the protocol is binary, in the machine's own byte order since client and
+// server share the machine: a request is a uint32 row count followed by that
+// many rows of num_of_attributes doubles, and the answer is num_of_models
+// doubles per row. a count of 0 asks for the shape instead, and is answered
+// with uint32 num_of_attributes and num_of_models. a request (or its answer)
+// larger than MAX_REQUEST bytes closes the connection, so a client can't make
+// the server buffer more than that. SIGINT or SIGTERM stops the server, and
+// each worker's counts are reported on stderr.
+
+#define MAX_EVENTS 64
+#define MAX_REQUEST (64 << 20)
+
+// what an epoll event is about
+#define CONN_STOP   0
+#define CONN_LISTEN 1
+#define CONN_CLIENT 2
+
+typedef struct Connection {
+  int fd;
+  int kind;
+  int http;           // speaks HTTP rather than the binary protocol
+  int writing;        // waiting for EPOLLOUT rather than EPOLLIN
+  int closing;        // to be closed once the output is written
+  Buffer in, out;
+  size_t sent;
+  struct Connection * prev, * next;
+} Connection;
+
+typedef struct {
+  int id, cpu;
+  int epoll;
+  Connection stop, tcp, local, http;
+  Connection * clients;
+  double ** weights;
+  int attributes, models;
+  double * row;
+  Buffer rows_in, body;       // an HTTP request's rows and its answer
+  pthread_t thread;
+  // counts, written only by this worker and read once it has stopped
+  long connections, requests, rows;
+  double bytes_in, bytes_out;
+  char pad[64];
+} Worker;
+
+// watches fd for events on behalf of conn (op EPOLL_CTL_ADD or _MOD)
+int watch(Worker * worker, Connection * conn, int op, unsigned events) {
+
+  struct epoll_event event;
+
+  event.events = events;
+  event.data.ptr = conn;
+
+  return epoll_ctl(worker->epoll, op, conn->fd, &event);
+
+}
+
+void closeClient(Worker * worker, Connection * conn) {
+
+  close(conn->fd);
+  if (conn->prev != NULL) {
+    conn->prev->next = conn->next;
+  } else {
+    worker->clients = conn->next;
+  }
+  if (conn->next != NULL) {
+    conn->next->prev = conn->prev;
+  }
+  free(conn->in.data);
+  free(conn->out.data);
+  free(conn);
+
+}
+
+void acceptClients(Worker * worker, Connection * listener) {
+
+  int fd, one = 1;
+
+  while ((fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    Connection * conn = calloc(1, sizeof(Connection));
+    conn->fd = fd;
+    conn->kind = CONN_CLIENT;
+    conn->http = listener->http;
+    if (listener != &worker->local) {
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (watch(worker, conn, EPOLL_CTL_ADD, EPOLLIN | EPOLLRDHUP) != 0) {
+      close(fd);
+      free(conn);
+      continue;
+    }
+    conn->next = worker->clients;
+    if (conn->next != NULL) {
+      conn->next->prev = conn;
+    }
+    worker->clients = conn;
+    worker->connections++;
+  }
+
+}
+
+// model m's price for a row of attributes
+double scoreRow(const Worker * worker, const double * row, int m) {
+
+  double price = worker->weights[0][m];
+  int a;
+
+  for (a = 0; a < worker->attributes; a++) {
+    price += worker->weights[a + 1][m] * row[a];
+  }
+
+  return price;
+
+}
+
+// answers every complete request in conn's input. returns 0, or -1 if a
+// request or its answer would be more than MAX_REQUEST bytes.
+int answerRequests(Worker * worker, Connection * conn) {
+
+  size_t used = 0;
+  size_t row_bytes = worker->attributes * sizeof(double);
+  int i, m;
+
+  while (conn->in.len - used >= sizeof(uint32_t)) {
+    uint32_t rows;
+    memcpy(&rows, conn->in.data + used, sizeof(rows));
+
+    if (rows == 0) {
+      uint32_t shape[2] = { worker->attributes, worker->models };
+      appendBuffer(&conn->out, (const char *) shape, sizeof(shape));
+      used += sizeof(rows);
+      continue;
+    }
+    size_t request_bytes = sizeof(rows) + (size_t) rows * row_bytes;
+    if (request_bytes > MAX_REQUEST || (size_t) rows * worker->models * sizeof(double) > MAX_REQUEST) {
+      return -1;
+    }
+    if (conn->in.len - used < request_bytes) {
+      break;
+    }
+
+    const char * p = conn->in.data + used + sizeof(rows);
+    double * prices = (double *) reserveBuffer(&conn->out, (size_t) rows * worker->models * sizeof(double));
+
+    // the request's doubles may not be aligned, so each row is copied out
+    for (i = 0; i < (int) rows; i++, p += row_bytes) {
+      memcpy(worker->row, p, row_bytes);
+      for (m = 0; m < worker->models; m++) {
+        double price = scoreRow(worker, worker->row, m);
+        memcpy(prices++, &price, sizeof(price));
+      }
+    }
+
+    used += request_bytes;
+    worker->requests++;
+    worker->rows += rows;
+  }
+
+  memmove(conn->in.data, conn->in.data + used, conn->in.len - used);
+  conn->in.len -= used;
+
+  return 0;
+
+}
+
+// --http port adds an HTTP/1.1 endpoint on 127.0.0.1 to the same workers,
+// for clients that can't speak the binary protocol:
+//
+//   POST /predict   a JSON array of rows, each an array of num_of_attributes
+//                   numbers, answered with an array of prices (of arrays of
+//                   prices, one per model, with several models)
+//   GET /           {"attributes": k, "models": m}
+//
+// connections are kept alive unless the client says otherwise, and requests
+// may be pipelined. bodies need a Content-Length; chunked uploads get 411.
+
+#define MAX_HEADER (16 << 10)
+#define MAX_BODY (64 << 20)
+
+// SWAR: eight ASCII digits read as one little-endian word are turned into
+// their value with three multiplies instead of eight multiply-adds.
+int eightDigits(uint64_t chunk) {
+  return ((chunk & 0xF0F0F0F0F0F0F0F0ULL) | (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+         == 0x3333333333333333ULL;
+}
+
+uint64_t eightDigitValue(uint64_t chunk) {
+  chunk = ((chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+  chunk = ((chunk & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+  return ((chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+}
+
+// adds the digits at p to mantissa, counting them in digits; past 19 they
+// are only counted. returns the end of the digits.
+char * scanDigits(char * p, char * end, unsigned long long * mantissa, int * digits) {
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t chunk;
+  while (end - p >= 8 && *digits <= 11) {
+    memcpy(&chunk, p, sizeof(chunk));
+    if (!eightDigits(chunk)) {
+      break;
+    }
+    *mantissa = *mantissa * 100000000 + eightDigitValue(chunk);
+    *digits += 8;
+    p += 8;
+  }
+#endif
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    if (*digits < 19) {
+      *mantissa = *mantissa * 10 + (*p - '0');
+    }
+    (*digits)++;
+  }
+
+  return p;
+
+}
+
+// parses a JSON number. most are short decimals, which are done here; those
+// with exponents or too many digits for the exact path go to parseNumber().
+// returns the end of the number, or NULL if there isn't one.
+char * parseJsonNumber(char * p, char * end, double * value) {
+
+  char * start = p;
+  unsigned long long mantissa = 0;
+  int digits = 0, whole, exponent = 0, negative = 0;
+
+  if (p < end && *p == '-') {
+    negative = 1;
+    p++;
+  }
+  p = scanDigits(p, end, &mantissa, &digits);
+  whole = digits;
+  if (whole == 0) {
+    return NULL;
+  }
+  if (p < end && *p == '.') {
+    p = scanDigits(p + 1, end, &mantissa, &digits);
+    if (digits == whole) {
+      return NULL;
+    }
+    exponent = whole - digits;
+  }
+
+  if ((p < end && (*p == 'e' || *p == 'E')) || digits > 19 || mantissa > (1ULL << 53) || exponent < -22) {
+    return parseNumber(start, end, value);
+  }
+
+  double v = exponent < 0 ? (double) mantissa / exact_powers[-exponent] : (double) mantissa;
+  *value = negative ? -v : v;
+
+  return p;
+
+}
+
+char * skipJsonSpace(char * p, char * end) {
+  for (; p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'); p++);
+  return p;
+}
+
+// parses a JSON array of rows of count numbers into rows. returns the number
+// of rows, or -1 with *error saying what was wrong.
+long parseJsonRows(char * p, char * end, int count, Buffer * rows, const char ** error) {
+
+  long n = 0;
+  int i;
+
+  rows->len = 0;
+  p = skipJsonSpace(p, end);
+  if (p == end || *p++ != '[') {
+    *error = "expected an array of rows";
+    return -1;
+  }
+  p = skipJsonSpace(p, end);
+
+  while (p < end && *p != ']') {
+    if (n > 0) {
+      if (*p++ != ',') {
+        *error = "expected , between rows";
+        return -1;
+      }
+      p = skipJsonSpace(p, end);
+    }
+    if (p == end || *p++ != '[') {
+      *error = "expected a row";
+      return -1;
+    }
+
+    double * row = (double *) reserveBuffer(rows, count * sizeof(double));
+    for (i = 0; i < count; i++) {
+      p = skipJsonSpace(p, end);
+      if (i > 0) {
+        if (p == end || *p++ != ',') {
+          *error = "row is too short";
+          return -1;
+        }
+        p = skipJsonSpace(p, end);
+      }
+      p = parseJsonNumber(p, end, &row[i]);
+      if (p == NULL) {
+        *error = "expected a number";
+        return -1;
+      }
+    }
+    p = skipJsonSpace(p, end);
+    if (p == end || *p++ != ']') {
+      *error = "row is too long";
+      return -1;
+    }
+    if (hasNonFinite(row, count)) {
+      *error = "value is out of range";
+      return -1;
+    }
+
+    n++;
+    p = skipJsonSpace(p, end);
+  }
+
+  if (p == end || skipJsonSpace(p + 1, end) != end) {
+    *error = "expected the array to end the body";
+    return -1;
+  }
+
+  return n;
+
+}
+
+// queues a response with a JSON body
+void httpRespond(Connection * conn, int code, const char * reason, const char * body, size_t len) {
+
+  char head[256];
+  int n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n%s\r\n",
+                   code, reason, len, conn->closing ? "Connection: close\r\n" : "");
+
+  appendBuffer(&conn->out, head, n);
+  appendBuffer(&conn->out, body, len);
+
+}
+
+void httpError(Connection * conn, int code, const char * reason, const char * message) {
+
+  char body[160];
+  int n = snprintf(body, sizeof(body), "{\"error\": \"%s\"}\n", message);
+
+  httpRespond(conn, code, reason, body, n);
+
+}
+
+// the value of header name in the header block [p, end), or NULL
+char * httpHeader(char * p, char * end, const char * name, size_t * len) {
+
+  size_t n = strlen(name);
+
+  while (p < end) {
+    char * eol = memchr(p, '\n', end - p);
+    if (eol == NULL) {
+      eol = end;
+    }
+    if ((size_t) (eol - p) > n && p[n] == ':' && strncasecmp(p, name, n) == 0) {
+      char * v = p + n + 1;
+      char * e = eol;
+      for (; v < e && (*v == ' ' || *v == '\t'); v++);
+      for (; e > v && (e[-1] == '\r' || e[-1] == ' ' || e[-1] == '\t'); e--);
+      *len = e - v;
+      return v;
+    }
+    p = eol + 1;
+  }
+
+  return NULL;
+
+}
+
+// scores a parsed request into worker->body as JSON
+void httpPredict(Worker * worker, const double * rows, long n) {
+
+  char text[32];
+  long r;
+  int m, len;
+
+  worker->body.len = 0;
+  appendBuffer(&worker->body, "[", 1);
+  for (r = 0; r < n; r++, rows += worker->attributes) {
+    if (r > 0) {
+      appendBuffer(&worker->body, ",", 1);
+    }
+    if (worker->models > 1) {
+      appendBuffer(&worker->body, "[", 1);
+    }
+    for (m = 0; m < worker->models; m++) {
+      len = snprintf(text, sizeof(text), m > 0 ? ",%.17g" : "%.17g", scoreRow(worker, rows, m));
+      appendBuffer(&worker->body, text, len);
+    }
+    if (worker->models > 1) {
+      appendBuffer(&worker->body, "]", 1);
+    }
+  }
+  appendBuffer(&worker->body, "]\n", 2);
+
+  worker->requests++;
+  worker->rows += n;
+
+}
+
+// answers every complete HTTP request in conn's input. returns 0, or -1 if
+// the connection is beyond saving (the error response is still sent).
+int answerHttp(Worker * worker, Connection * conn) {
+
+  size_t used = 0;
+
+  while (!conn->closing && used < conn->in.len) {
+    char * head = conn->in.data + used;
+    char * stop = conn->in.data + conn->in.len;
+    char * blank = memmem(head, stop - head, "\r\n\r\n", 4);
+    size_t len, body_len = 0;
+    char * value;
+
+    if (blank == NULL) {
+      if (stop - head > MAX_HEADER) {
+        conn->closing = 1;
+        httpError(conn, 431, "Request Header Fields Too Large", "headers too large");
+      }
+      break;
+    }
+
+    // request line: method target version
+    char * line_end = memchr(head, '\r', blank + 2 - head);
+    char * target = memchr(head, ' ', line_end - head);
+    char * version = target != NULL ? memchr(target + 1, ' ', line_end - target - 1) : NULL;
+    if (version == NULL || line_end - version != 9 || strncmp(version + 1, "HTTP/1.", 7) != 0) {
+      conn->closing = 1;
+      httpError(conn, 400, "Bad Request", "malformed request line");
+      break;
+    }
+    char * headers = line_end + 2;
+
+    // HTTP/1.1 keeps the connection by default, 1.0 only if asked
+    value = httpHeader(headers, blank + 2, "Connection", &len);
+    if (version[8] == '0') {
+      conn->closing = value == NULL || len != 10 || strncasecmp(value, "keep-alive", 10) != 0;
+    } else {
+      conn->closing = value != NULL && len == 5 && strncasecmp(value, "close", 5) == 0;
+    }
+
+    if (httpHeader(headers, blank + 2, "Transfer-Encoding", &len) != NULL) {
+      conn->closing = 1;
+      httpError(conn, 411, "Length Required", "send a Content-Length");
+      break;
+    }
+    value = httpHeader(headers, blank + 2, "Content-Length", &len);
+    if (value != NULL) {
+      char * rest;
+      body_len = strtoul(value, &rest, 10);
+      if (rest != value + len || body_len > MAX_BODY) {
+        conn->closing = 1;
+        httpError(conn, 413, "Payload Too Large", "body too large");
+        break;
+      }
+    }
+    char * body = blank + 4;
+    if ((size_t) (stop - body) < body_len) {
+      // wait for the rest of the body
+      break;
+    }
+    used = body + body_len - conn->in.data;
+
+    size_t method = target - head;
+    size_t path = version - target - 1;
+    if (method == 4 && strncmp(head, "POST", 4) == 0 && path == 8 && strncmp(target + 1, "/predict", 8) == 0) {
+      const char * error;
+      long n = parseJsonRows(body, body + body_len, worker->attributes, &worker->rows_in, &error);
+      if (n < 0) {
+        httpError(conn, 400, "Bad Request", error);
+      } else {
+        httpPredict(worker, (const double *) worker->rows_in.data, n);
+        httpRespond(conn, 200, "OK", worker->body.data, worker->body.len);
+      }
+    } else if (method == 3 && strncmp(head, "GET", 3) == 0 && path == 1 && target[1] == '/') {
+      char shape[64];
+      int n = snprintf(shape, sizeof(shape), "{\"attributes\": %d, \"models\": %d}\n",
+                       worker->attributes, worker->models);
+      httpRespond(conn, 200, "OK", shape, n);
+    } else {
+      httpError(conn, 404, "Not Found", "try POST /predict");
+    }
+  }
+
+  memmove(conn->in.data, conn->in.data + used, conn->in.len - used);
+  conn->in.len -= used;
+
+  return 0;
+
+}
+
+// reads what has arrived, answers it and writes out what it can. while an
+// answer is only partly written the client isn't read from, so a client that
+// doesn't read can't make the server hold more than one read's worth of
+// answers. returns 0, or -1 when the connection should be closed.
+int serveClient(Worker * worker, Connection * conn, unsigned events) {
+
+  ssize_t n;
+
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    return -1;
+  }
+
+  if (!conn->writing && (events & EPOLLIN)) {
+    // room for a whole read past what's buffered
+    reserveBuffer(&conn->in, READ_CHUNK);
+    conn->in.len -= READ_CHUNK;
+
+    n = read(conn->fd, conn->in.data + conn->in.len, conn->in.size - conn->in.len);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      return -1;
+    }
+    if (n > 0) {
+      conn->in.len += n;
+      worker->bytes_in += n;
+    }
+    if ((conn->http ? answerHttp(worker, conn) : answerRequests(worker, conn)) != 0) {
+      return -1;
+    }
+  }
+
+  while (conn->sent < conn->out.len) {
+    n = send(conn->fd, conn->out.data + conn->sent, conn->out.len - conn->sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return -1;
+      }
+      break;
+    }
+    conn->sent += n;
+    worker->bytes_out += n;
+  }
+
+  int writing = conn->sent < conn->out.len;
+  if (!writing) {
+    conn->out.len = conn->sent = 0;
+    if (conn->closing) {
+      return -1;
+    }
+  }
+  if (writing != conn->writing) {
+    conn->writing = writing;
+    if (watch(worker, conn, EPOLL_CTL_MOD, (writing ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP) != 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+
+}
+
+void * serveWorker(void * arg) {
+
+  Worker * worker = arg;
+  struct epoll_event events[MAX_EVENTS];
+  int i, n, running = 1;
+
+  // a worker per cpu, kept on its own
+  if (worker->cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+
+  while (running) {
+    n = epoll_wait(worker->epoll, events, MAX_EVENTS, -1);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      break;
+    }
+    for (i = 0; i < n; i++) {
+      Connection * conn = events[i].data.ptr;
+      if (conn->kind == CONN_STOP) {
+        running = 0;
+      } else if (conn->kind == CONN_LISTEN) {
+        acceptClients(worker, conn);
+      } else if (serveClient(worker, conn, events[i].events) != 0) {
+        closeClient(worker, conn);
+      }
+    }
+  }
+
+  while (worker->clients != NULL) {
+    closeClient(worker, worker->clients);
+  }
+
+  return NULL;
+
+}
+
+// a listening TCP socket on 127.0.0.1:port that others can share. returns the
+// socket, or -1 once the problem has been reported.
+int listenTcp(int port) {
+
+  struct sockaddr_in addr;
+  int one = 1;
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (fd < 0
+      || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+      || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0
+      || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+      || listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "127.0.0.1:%d: %s\n", port, strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  return fd;
+
+}
+
+// a listening Unix socket at path, replacing a stale socket left there but
+// nothing else. returns the socket, or -1 once the problem has been reported.
+int listenLocal(const char * path) {
+
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: path too long for a socket\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+    perror(path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  return fd;
+
+}
+
+// opens a worker's listener on *port, which is shared by every worker. with
+// port 0 the first listener picks a port and the rest take the same one.
+// returns 0, or -1 once the problem has been reported.
+int shareTcp(Connection * listener, int * port, int http) {
+
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  listener->fd = listenTcp(*port);
+  listener->kind = CONN_LISTEN;
+  listener->http = http;
+  if (listener->fd < 0) {
+    return -1;
+  }
+  if (*port == 0) {
+    getsockname(listener->fd, (struct sockaddr *) &addr, &len);
+    *port = ntohs(addr.sin_port);
+  }
+
+  return 0;
+
+}
+
+// serves the stacked weights until SIGINT or SIGTERM. port or http_port < 0,
+// or a NULL socket_path, leaves that side out. returns 0, or -1 if the
+// server couldn't be started.
+int serve(double ** weights, int num_of_attributes, int num_of_models, int port, const char * socket_path,
+          int http_port, int threads) {
+
+  int t, c, sig, status = 0;
+  int local = -1, stop = eventfd(0, EFD_CLOEXEC);
+  sigset_t signals;
+  cpu_set_t affinity;
+
+  Worker * workers = calloc(threads, sizeof(Worker));
+
+  if (socket_path != NULL) {
+    local = listenLocal(socket_path);
+    status = local < 0 ? -1 : 0;
+  }
+
+  // workers are pinned only if there's a cpu for each
+  CPU_ZERO(&affinity);
+  sched_getaffinity(0, sizeof(affinity), &affinity);
+  int pin = CPU_COUNT(&affinity) >= threads;
+
+  for (t = 0, c = 0; t < threads; t++) {
+    Worker * worker = &workers[t];
+    worker->id = t;
+    worker->cpu = -1;
+    for (; pin && !CPU_ISSET(c, &affinity); c++);
+    if (pin) {
+      worker->cpu = c++;
+    }
+    worker->weights = weights;
+    worker->attributes = num_of_attributes;
+    worker->models = num_of_models;
+    worker->row = malloc((num_of_attributes + 1) * sizeof(double));
+    worker->epoll = epoll_create1(EPOLL_CLOEXEC);
+    worker->stop.fd = stop;
+    worker->stop.kind = CONN_STOP;
+    worker->tcp.fd = -1;
+    worker->http.fd = -1;
+    worker->local.fd = local;
+
+    if (status == 0 && port >= 0) {
+      status = shareTcp(&worker->tcp, &port, 0);
+    }
+    if (status == 0 && http_port >= 0) {
+      status = shareTcp(&worker->http, &http_port, 1);
+    }
+
+    if (status == 0) {
+      watch(worker, &worker->stop, EPOLL_CTL_ADD, EPOLLIN);
+      if (worker->tcp.fd >= 0) {
+        watch(worker, &worker->tcp, EPOLL_CTL_ADD, EPOLLIN);
+      }
+      if (worker->http.fd >= 0) {
+        watch(worker, &worker->http, EPOLL_CTL_ADD, EPOLLIN);
+      }
+      if (local >= 0) {
+        worker->local.kind = CONN_LISTEN;
+        watch(worker, &worker->local, EPOLL_CTL_ADD, EPOLLIN | EPOLLEXCLUSIVE);
+      }
+    }
+  }
+
+  if (status == 0) {
+    // only this thread takes the signals; the workers inherit the mask
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    for (t = 0; t < threads; t++) {
+      pthread_create(&workers[t].thread, NULL, serveWorker, &workers[t]);
+    }
+
+    fprintf(stderr, "serving %d model%s of %d attributes with %d workers on", num_of_models,
+            num_of_models > 1 ? "s" : "", num_of_attributes, threads);
+    const char * separator = " ";
+    if (port >= 0) {
+      fprintf(stderr, "%s127.0.0.1:%d", separator, port);
+      separator = ", ";
+    }
+    if (http_port >= 0) {
+      fprintf(stderr, "%shttp://127.0.0.1:%d/", separator, http_port);
+      separator = ", ";
+    }
+    if (local >= 0) {
+      fprintf(stderr, "%s%s", separator, socket_path);
+    }
+    fprintf(stderr, "\n");
+
+    sigwait(&signals, &sig);
+
+    uint64_t one = 1;
+    if (write(stop, &one, sizeof(one)) != sizeof(one)) {
+      perror("eventfd");
+    }
+    for (t = 0; t < threads; t++) {
+      Worker * worker = &workers[t];
+      pthread_join(worker->thread, NULL);
+      fprintf(stderr, "worker %d: %ld connections, %ld requests, %ld rows, %.0f bytes in, %.0f bytes out\n",
+              t, worker->connections, worker->requests, worker->rows, worker->bytes_in, worker->bytes_out);
+    }
+  }
+
+  for (t = 0; t < threads; t++) {
+    if (workers[t].tcp.fd >= 0) {
+      close(workers[t].tcp.fd);
+    }
+    if (workers[t].http.fd >= 0) {
+      close(workers[t].http.fd);
+    }
+    close(workers[t].epoll);
+    free(workers[t].row);
+    free(workers[t].rows_in.data);
+    free(workers[t].body.data);
+  }
+  if (local >= 0) {
+    close(local);
+    unlink(socket_path);
+  }
+  close(stop);
+  free(workers);
+
+  return status;
+
+}
+
+// ----- FOLLOWING ----------
+//
+// with --follow the data file is treated as a log that keeps growing: the
+// models are trained once, the rows already in the file are scored, and then
+// every row appended to it is scored as soon as its line is complete. the
+// header's row count is ignored, as the file has no fixed length. inotify
+// wakes the loop when the file is written, with a poll every FOLLOW_POLL ms
+// as a fallback for file systems that don't report changes. only whole lines
+// are scored; a partial last line waits for its newline. the output is
+// flushed after every batch of lines.
+//
+// with --follow=state the offset and line number after the last scored line
+// are written to the file state after each batch, and a later run that finds
+// them there picks up where it left off instead of rescoring the file. the
+// loop ends when the file is moved or deleted, or after a malformed row or a
+// truncation; state then still points at the start of the failed batch.
+
+#define FOLLOW_CHUNK (1 << 20)
+#define FOLLOW_POLL 1000
+
+// the number of lines in [p, end) that aren't blank
+int countRows(const char * p, const char * end) {
+
+  int rows = 0, blank = 1;
+
+  for (; p < end; p++) {
+    if (*p == '\n') {
+      rows += !blank;
+      blank = 1;
+    } else if (!isBlank(*p)) {
+      blank = 0;
+    }
+  }
+
+  return rows + !blank;
+
+}
+
+// reads a saved position. returns 1 if state held one, 0 if not.
+int loadFollowState(const char * state_path, long long * offset, long * line) {
+
+  FILE * state = fopen(state_path, "r");
+  int found;
+
+  if (state == NULL) {
+    return 0;
+  }
+  found = fscanf(state, "%lld %ld", offset, line) == 2 && *offset >= 0 && *line >= 0;
+  fclose(state);
+
+  return found;
+
+}
+
+// writes the position next to state and renames it into place, so a run
+// killed mid-write leaves the previous position rather than half of one
+int saveFollowState(const char * state_path, long long offset, long line) {
+
+  char path[4096];
+  FILE * state;
+
+  snprintf(path, sizeof(path), "%s.tmp", state_path);
+  state = fopen(path, "w");
+  if (state == NULL) {
+    perror(path);
+    return -1;
+  }
+  fprintf(state, "%lld %ld\n", offset, line);
+  if (fclose(state) != 0 || rename(path, state_path) != 0) {
+    perror(state_path);
+    return -1;
+  }
+
+  return 0;
+
+}
+
+// scores path's rows as they are appended, until it goes away. returns 0, or
+// -1 once a problem has been reported.
+int follow(const char * path, const char * state_path, double ** weights, int num_of_attributes,
+           int num_of_models, const Spread * spread, const Sensitivity * sensitivity) {
+
+  FILE * file = fopen(path, "r");
+  Reader reader;
+  Buffer pending = { NULL, 0, 0 };
+  char kind[16];
+  char events[4096];
+  struct stat st;
+  long long offset, saved_offset;
+  long line, saved_line;
+  int attributes, houses, watch, status, gone = 0;
+
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  initReader(&reader, file, path);
+  status = readHeader(&reader, kind, sizeof(kind), &attributes, &houses);
+  offset = readerOffset(&reader);
+  line = reader.line;
+  freeReader(&reader);
+  if (status != 0) {
+    fclose(file);
+    return -1;
+  }
+
+  if (state_path != NULL && loadFollowState(state_path, &saved_offset, &saved_line)) {
+    if (saved_offset < offset || fstat(fileno(file), &st) != 0 || saved_offset > st.st_size) {
+      fprintf(stderr, "%s: saved offset %lld doesn't fit %s, starting over\n", state_path, saved_offset, path);
+    } else {
+      offset = saved_offset;
+      line = saved_line;
+    }
+  }
+
+  int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (notify >= 0) {
+    watch = inotify_add_watch(notify, path, IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF);
+    if (watch < 0) {
+      close(notify);
+      notify = -1;
+    }
+  }
+
+  while (status == 0) {
+    // everything complete that's there now, a chunk at a time
+    for (;;) {
+      char * chunk = reserveBuffer(&pending, FOLLOW_CHUNK);
+      ssize_t n = pread(fileno(file), chunk, FOLLOW_CHUNK, offset + (long long) (pending.len - FOLLOW_CHUNK));
+      pending.len -= FOLLOW_CHUNK - (n > 0 ? n : 0);
+      if (n < 0) {
+        perror(path);
+        status = -1;
+        break;
+      }
+
+      char * last = pending.len > 0 ? memrchr(pending.data, '\n', pending.len) : NULL;
+      if (last != NULL) {
+        size_t complete = last + 1 - pending.data;
+        Reader lines;
+
+        initMemoryReader(&lines, pending.data, complete, path);
+        lines.line = line;
+        status = predict(&lines, weights, num_of_attributes, countRows(pending.data, last), num_of_models, spread,
+                         sensitivity, NULL, NULL, NULL, NULL);
+        fflush(stdout);
+        if (status != 0) {
+          break;
+        }
+
+        offset += complete;
+        line = lines.line;
+        pending.len -= complete;
+        memmove(pending.data, pending.data + complete, pending.len);
+        if (state_path != NULL && saveFollowState(state_path, offset, line) != 0) {
+          status = -1;
+          break;
+        }
+      }
+      if (n < FOLLOW_CHUNK) {
+        break;
+      }
+    }
+
+    if (status != 0 || gone) {
+      break;
+    }
+
+    if (fstat(fileno(file), &st) == 0 && st.st_size < offset + (long long) pending.len) {
+      fprintf(stderr, "%s: file truncated at %lld bytes\n", path, (long long) st.st_size);
+      status = -1;
+      break;
+    }
+
+    // wait for the next write. a move or delete still gets one last read,
+    // for anything written just before it
+    if (notify >= 0) {
+      struct pollfd wait = { notify, POLLIN, 0 };
+      ssize_t n;
+      if (poll(&wait, 1, FOLLOW_POLL) > 0) {
+        while ((n = read(notify, events, sizeof(events))) > 0) {
+          char * p;
+          for (p = events; p < events + n; p += sizeof(struct inotify_event) + ((struct inotify_event *) p)->len) {
+            gone |= (((struct inotify_event *) p)->mask & IN_MOVE_SELF) != 0;
+          }
+        }
+      }
+    } else {
+      poll(NULL, 0, FOLLOW_POLL);
+    }
+    // our descriptor keeps a deleted file alive, so its delete event would
+    // never come
+    if (fstat(fileno(file), &st) == 0 && st.st_nlink == 0) {
+      gone = 1;
+    }
+  }
+
+  if (notify >= 0) {
+    close(notify);
+  }
+  free(pending.data);
+  fclose(file);
+
+  return status;
+
+}
+
+// ----- SNAPSHOTS ----------
+//
+// accumulate --every n writes a Gram file holding the sums over the first n
+// rows, the first 2n and so on up to all of them, the training files being
+// taken in order as one run of rows. when the rows are in time order, that
+// makes the model of any stretch starting and ending on a multiple of n (or
+// the last row) cheap: the sums over rows [A, B) are the snapshot at B less
+// the one at A, and solving them costs O(attributes^3) however many rows
+// they cover. accumulate --rows A:B writes those sums as a Gram file of
+// their own and solve --rows A:B solves them. the snapshots are running
+// totals, so a short stretch late in a long history loses some precision
+// to the subtraction.
+//
+// the files are read in parallel, each summing its rows n at a time; the
+// stretches that straddle two files are added up afterwards, in file order,
+// and then the running totals taken.
+
+// accumulates files into a Gram file with snapshots every every rows: its
+// header and *snapshots. returns 0, or -1 once a problem has been reported.
+int snapshotFiles(const FileList * files, int num_of_attributes, long long every, int threads,
+                  GramHeader * header, double ** snapshots) {
+
+  int i, status = 0;
+  int cols = num_of_attributes + 1;
+  int workers = threads < files->count ? threads : files->count;
+  size_t v, values = gramValues(cols);
+  long long b, rows = 0;
+  InputInfo info;
+
+  FileSums * sums = calloc(files->count, sizeof(FileSums));
+
+  // where each file's rows start in the run
+  for (i = 0; i < files->count && status == 0; i++) {
+    status = peekHeader(files->paths[i], &info);
+    sums[i].path = files->paths[i];
+    sums[i].attributes = num_of_attributes;
+    sums[i].threads = 1;
+    sums[i].every = every;
+    sums[i].first_row = rows;
+    rows += info.houses;
+  }
+  if (status != 0) {
+    free(sums);
+    return -1;
+  }
+
+  initGram(header, num_of_attributes, rows);
+  header->every = every;
+  header->count = snapshotCount(every, rows);
+  *snapshots = calloc(header->count * values, sizeof(double));
+
+  accumulateAll(sums, files->count, workers);
+
+  for (i = 0; i < files->count; i++) {
+    if (sums[i].status != 0) {
+      status = -1;
+    }
+    if (status == 0 && sums[i].houses > 0) {
+      long long first = sums[i].first_row / every;
+      long long last = (sums[i].first_row + sums[i].houses - 1) / every;
+      for (b = first; b <= last; b++) {
+        for (v = 0; v < values; v++) {
+          (*snapshots)[b * values + v] += sums[i].buckets[(b - first) * values + v];
+        }
+      }
+    }
+    free(sums[i].buckets);
+  }
+
+  for (b = 1; b < header->count && status == 0; b++) {
+    for (v = 0; v < values; v++) {
+      (*snapshots)[b * values + v] += (*snapshots)[(b - 1) * values + v];
+    }
+  }
+
+  free(sums);
+
+  return status;
+
+}
+
+// the sums over rows [first, last) of a Gram file, from its snapshots.
+// returns 0, or -1 once a problem has been reported.
+int rangeSums(FILE * file, const char * path, const GramHeader * header, long long first, long long last,
+              double * sums) {
+
+  int cols = (int) header->attributes + 1;
+  size_t v, values = gramValues(cols);
+  long long ends[2], sets[2];
+  int e, status = 0;
+
+  ends[0] = first;
+  ends[1] = last;
+  for (e = 0; e < 2; e++) {
+    if (ends[e] > header->houses) {
+      fprintf(stderr, "%s: --rows %lld:%lld is past the last row (%lld)\n", path, first, last, header->houses);
+      return -1;
+    }
+    if (ends[e] != 0 && ends[e] != header->houses && (header->every == 0 || ends[e] % header->every != 0)) {
+      fprintf(stderr, "%s: --rows must start and end on a snapshot, every %lld rows, or the last row (%lld)\n",
+              path, header->every, header->houses);
+      return -1;
+    }
+    sets[e] = ends[e] == header->houses ? header->count - 1 : header->every > 0 ? ends[e] / header->every - 1 : -1;
+  }
+
+  double * start = malloc(values * sizeof(double));
+
+  memset(sums, 0, values * sizeof(double));
+  if (last > 0) {
+    status = readSnapshot(file, path, header, sets[1], sums);
+  }
+  if (status == 0 && first > 0) {
+    status = readSnapshot(file, path, header, sets[0], start);
+    for (v = 0; v < values; v++) {
+      sums[v] -= start[v];
+    }
+  }
+  free(start);
+
+  return status;
+
+}
+
+void usage(const char * prog) {
+    fprintf(stderr, "usage: %s [-m train]... [--plan] [--mode=auto|in-core|streaming|out-of-core]\n"
+                    "       [--threads n] [--interval[=z]] [--ref file | --follow[=state] | --rows A:B] [--top k]\n"
+                    "       [--filter attribute<value]... [--vary attribute:delta,...]... [--deadline seconds]\n"
+                    "       [--index] train... data\n"
+                    "       %s --key [--threads n] [--ref file] train data\n"
+                    "       %s [-m train]... [--threads n] [--serve port] [--socket path] [--http port] train\n"
+                    "       %s --window n train\n"
+                    "       %s accumulate [--threads n] [--every n | --rows A:B] train... > sums\n"
+                    "       %s merge sums... > sums\n"
+                    "       %s solve [--threads n] [--rows A:B] sums... > model\n", prog, prog, prog, prog, prog, prog,
+                    prog);
+}
+
+// ----- SUBCOMMANDS ----------
+//
+// accumulate, merge and solve (see GRAM FILES and SNAPSHOTS). each reads its
+// inputs as training files and writes what it makes to stdout.
+
+// runs the subcommand named by argv[0]. returns the exit status.
+int subcommand(const char * prog, int argc, char ** argv) {
+
+  int i, opt, threads = 0, status = 0;
+  int merging = strcmp(argv[0], "merge") == 0;
+  int solving = strcmp(argv[0], "solve") == 0;
+  long long every = 0, first_row = 0, last_row = -1;
+  int ranged = 0;
+  char * rest;
+  FileList files = { NULL, 0 };
+  InputInfo info;
+  GramHeader gram;
+
+  static const struct option long_options[] = {
+    { "threads", required_argument, NULL, 't' },
+    { "every", required_argument, NULL, 'e' },
+    { "rows",  required_argument, NULL, 'R' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  // merge takes no options, solve no --every
+  while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+    if (opt == 't' && !merging) {
+      threads = atoi(optarg);
+      status = threads < 1 ? -1 : 0;
+    } else if (opt == 'e' && !merging && !solving) {
+      every = strtoll(optarg, &rest, 10);
+      status = *optarg == '\0' || *rest != '\0' || every < 1 ? -1 : 0;
+    } else if (opt == 'R' && !merging) {
+      ranged = 1;
+      status = parseRange(optarg, &first_row, &last_row);
+    } else {
+      status = -1;
+    }
+    if (status != 0) {
+      usage(prog);
+      return 1;
+    }
+  }
+  if (optind == argc || (ranged && (every > 0 || argc - optind != 1))) {
+    usage(prog);
+    return 1;
+  }
+
+  for (i = optind; i < argc && status == 0; i++) {
+    status = addFiles(&files, argv[i]);
+  }
+  if (status == 0) {
+    status = peekFiles(&files, &info);
+  }
+
+  // merge adds up Gram files and nothing else, and --rows reads one
+  for (i = 0; i < files.count && status == 0 && (merging || ranged); i++) {
+    FILE * file = fopen(files.paths[i], "rb");
+    if (file == NULL || !readGramHeader(file, &gram)) {
+      fprintf(stderr, "%s: not a Gram file\n", files.paths[i]);
+      status = -1;
+    }
+    if (file != NULL) {
+      fclose(file);
+    }
+  }
+  if (status != 0 || (ranged && files.count != 1)) {
+    if (status == 0) {
+      usage(prog);
+    }
+    freeFiles(&files);
+    return 1;
+  }
+
+  Resources resources;
+  int cols = info.attributes + 1;
+  long long houses = 0;
+  double * sums = NULL;
+  double ** product_x = allocMatrix(cols, cols);
+  double ** product_y = allocMatrix(cols + 1, 1);
+
+  detectResources(&resources, threads);
+  threads = threadsFor(&resources, info.bytes);
+
+  if (every > 0) {
+    status = snapshotFiles(&files, info.attributes, every, threads, &gram, &sums);
+    if (status == 0) {
+      status = writeGram(stdout, &gram, sums);
+    }
+    free(sums);
+    sums = NULL;
+  } else if (ranged) {
+    FILE * file = fopen(files.paths[0], "rb");
+    sums = malloc(gramValues(cols) * sizeof(double));
+    status = file != NULL && readGramHeader(file, &gram) ? 0 : -1;
+    if (file == NULL) {
+      perror(files.paths[0]);
+    }
+    last_row = last_row >= 0 ? last_row : gram.houses;
+    if (status == 0) {
+      status = rangeSums(file, files.paths[0], &gram, first_row, last_row, sums);
+    }
+    if (status == 0) {
+      addPacked(sums, cols, product_x, product_y);
+      houses = last_row - first_row;
+    }
+    if (file != NULL) {
+      fclose(file);
+    }
+  } else {
+    sums = malloc(gramValues(cols) * sizeof(double));
+    status = sumFiles(&files, info.attributes, threads, product_x, product_y, &houses);
+  }
+
+  if (status == 0 && solving) {
+    double ** vector_w = solveSums(product_x, product_y, cols, houses, NULL, files.paths[0]);
+    status = writeModel(stdout, vector_w, info.attributes);
+    freeMatrix(vector_w);
+  } else if (status == 0 && sums != NULL) {
+    initGram(&gram, info.attributes, houses);
+    packSums(product_x, product_y, cols, sums);
+    status = writeGram(stdout, &gram, sums);
+  }
+
+  free(sums);
+  freeMatrix(product_x);
+  freeMatrix(product_y);
+  freeFiles(&files);
+
+  return status == 0 ? 0 : 1;
+
+}
+
+int main(int argc, char ** argv) {
+
+    double started = monotonicSeconds();
+    int i, j, opt;
+    int plan_only = 0, mode = MODE_AUTO, threads = 0, window = 0, keyed = 0, following = 0;
+    double interval = 0, deadline = 0;
+    const char * ref_path = NULL;
+    const char * state_path = NULL;
+    long long first_row = 0, last_row = -1;
+    int ranged = 0, indexing = 0, top_k = 0;
+    Filter filter = { 0 };
+    Sensitivity sensitivity = { 0 };
+    const char * socket_path = NULL;
+    int port = -1, http_port = -1;
+    char * rest;
+    long number;
+
+    static const struct option long_options[] = {
+      { "model", required_argument, NULL, 'm' },
+      { "plan",  no_argument,       NULL, 'p' },
+      { "mode",  required_argument, NULL, 'M' },
+      { "threads", required_argument, NULL, 't' },
+      { "window", required_argument, NULL, 'w' },
+      { "key",   no_argument,       NULL, 'k' },
+      { "interval", optional_argument, NULL, 'i' },
+      { "ref",   required_argument, NULL, 'r' },
+      { "serve", required_argument, NULL, 'S' },
+      { "socket", required_argument, NULL, 'U' },
+      { "http",  required_argument, NULL, 'H' },
+      { "follow", optional_argument, NULL, 'f' },
+      { "rows",  required_argument, NULL, 'R' },
+      { "index", no_argument,       NULL, 'X' },
+      { "top",   required_argument, NULL, 'T' },
+      { "filter", required_argument, NULL, 'F' },
+      { "vary",  required_argument, NULL, 'V' },
+      { "deadline", required_argument, NULL, 'D' },
+      { NULL, 0, NULL, 0 }
+    };
+
+    if (argc > 1 && (strcmp(argv[1], "accumulate") == 0 || strcmp(argv[1], "merge") == 0
+                     || strcmp(argv[1], "solve") == 0)) {
+      return subcommand(argv[0], argc - 1, argv + 1);
+    }
+
+    // every -m adds another model to score alongside the positional
+    // training file. predictions are printed one column per model, in order.
+    const char ** model_paths = malloc(argc * sizeof(char *));
+    int num_of_models = 1;
+
+    while ((opt = getopt_long(argc, argv, "m:", long_options, NULL)) != -1) {
+      switch (opt) {
+      case 'm':
+        model_paths[num_of_models++] = optarg;
+        break;
+      case 'p':
+        plan_only = 1;
+        break;
+      case 'M':
+        for (mode = MODE_OOC; mode > MODE_AUTO && strcmp(optarg, mode_names[mode]) != 0; mode--);
+        if (mode == MODE_AUTO && strcmp(optarg, "auto") != 0) {
+          usage(argv[0]);
+          free(model_paths);
+          return 1;
+        }
+        break;
+      case 't':
+        threads = atoi(optarg);
+        if (threads < 1) {
+          usage(argv[0]);
+          free(model_paths);
+          return 1;
+        }
+        break;
+      case 'w':
+        window = atoi(optarg);
+        if (window < 1) {
+          usage(argv[0]);
+          free(model_paths);
+          return 1;
+        }
+        break;
+      case 'k':
+        keyed = 1;
+        break;
+      case 'r':
+        ref_path = optarg;
+        break;
+      case 'S':
+      case 'H':
+        // 0 lets the kernel pick the port
+        number = strtol(optarg, &rest, 10);
+        if (*optarg == '\0' || *rest != '\0' || number < 0 || number > 65535) {
+          usage(argv[0]);
+          free(model_paths);
+          return 1;
+        }
+        *(opt == 'S' ? &port : &http_port) = (int) number;
+        break;
+      case 'U':
+        socket_path = optarg;
+        break;
+      case 'F':
+        // every predicate must hold
+        if (filter.count == MAX_PREDICATES || parsePredicate(optarg, &filter.predicates[filter.count]) != 0) {
+          usage(argv[0]);
+          free(model_paths);
+          return 1;
+        }
+        filter.count++;
+        break;
+      case 'V':
+        if (parseVariants(optarg, &sensitivity) != 0) {
+          usage(argv[0]);
+          free(model_paths);
+          return 1;
+        }
+        break;
+      case 'T':
+        number = strtol(optarg, &rest, 10);
+        if (*optarg == '\0' || *rest != '\0' || number < 1 || number > MAX_TOP) {
+          usage(argv[0]);
+          free(model_paths);
+          return 1;
+        }
+        top_k = (int) number;
+        break;
+      case 'f':
+        following = 1;
+        state_path = optarg;
+        break;
+      case 'R':
+        ranged = 1;
+        if (parseRange(optarg, &first_row, &last_row) != 0) {
+          usage(argv[0]);
+          free(model_paths);
+          return 1;
+        }
+        break;
+      case 'X':
+        indexing = 1;
+        break;
+      case 'D':
+        deadline = strtod(optarg, &rest);
+        if (*optarg == '\0' || *rest != '\0' || !(deadline > 0)) {
+          usage(argv[0]);
+          free(model_paths);
+          return 1;
+        }
+        break;
+      case 'i':
+        // standard errors either side; 1.96 is a 95% interval
+        interval = optarg != NULL ? atof(optarg) : 1.96;
+        if (!(interval > 0)) {
+          usage(argv[0]);
+          free(model_paths);
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        free(model_paths);
+        return 1;
+      }
+    }
+
+    int serving = port >= 0 || socket_path != NULL || http_port >= 0;
+
+    // the windowed mode prints weights, not predictions, so it takes only
+    // the training file
+    if (window > 0) {
+      free(model_paths);
+      if (argc - optind != 1 || num_of_models != 1 || plan_only || keyed || interval > 0 || ref_path != NULL
+          || serving || following || ranged || indexing || top_k > 0 || filter.count > 0
+          || sensitivity.count > 0 || deadline > 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      return slideWindow(argv[optind], window) == 0 ? 0 : 1;
+    }
+
+    // a server takes its rows from clients rather than a data file
+    if (argc - optind < (serving ? 1 : 2)
+        || (keyed && (num_of_models != 1 || plan_only || interval > 0 || deadline > 0))
+        || (interval > 0 && num_of_models != 1)
+        || (serving && (keyed || plan_only || interval > 0 || ref_path != NULL))
+        || (following && (serving || keyed || plan_only || ref_path != NULL))
+        || (ranged && (serving || keyed || following || ref_path != NULL))
+        || (indexing && (serving || keyed || following))
+        || (top_k > 0 && (serving || keyed || following))
+        || (filter.count > 0 && (serving || keyed || following || ref_path != NULL))
+        || (sensitivity.count > 0 && (num_of_models != 1 || interval > 0 || serving || keyed))) {
+      usage(argv[0]);
+      free(model_paths);
+      return 1;
+    }
+    model_paths[0] = argv[optind];
+
+    // every positional argument before the data file is a training file of
+    // the first model, and any of the arguments may be a glob pattern
+    const char * data_path = serving ? NULL : argv[argc - 1];
+    FileList * training = calloc(num_of_models, sizeof(FileList));
+    int status = 0;
+
+    for (i = optind; i < argc - (serving ? 0 : 1) && status == 0; i++) {
+      status = addFiles(&training[0], argv[i]);
+    }
+    for (i = 1; i < num_of_models && status == 0; i++) {
+      status = addFiles(&training[i], model_paths[i]);
+    }
+    if (status != 0 || (keyed && training[0].count != 1)) {
+      if (status == 0) {
+        usage(argv[0]);
+      }
+      freeTraining(training, num_of_models);
+      free(model_paths);
+      return 1;
+    }
+
+    // a plain run on a few rows skips everything below
+    if (num_of_models == 1 && !serving && !keyed && !following && !ranged && top_k == 0 && filter.count == 0
+        && sensitivity.count == 0 && training[0].count == 1 && !plan_only && interval == 0 && ref_path == NULL
+        && deadline == 0 && (mode == MODE_AUTO || mode == MODE_INCORE)) {
+      int tiny = estimateTiny(training[0].paths[0], data_path);
+      if (tiny != TINY_SKIP) {
+        freeTraining(training, num_of_models);
+        free(model_paths);
+        return tiny == 0 ? 0 : 1;
+      }
+    }
+
+    // read every header before any rows, so a mismatch is caught before
+    // spending time on training and the plan can be made up front
+    InputInfo * model_info = malloc(num_of_models * sizeof(InputInfo));
+    InputInfo data_info;
+    status = peekHeader(serving ? training[0].paths[0] : data_path, &data_info);
+
+    if (serving) {
+      data_info.houses = 0;
+      data_info.bytes = 0;
+    }
+
+    for (i = 0; i < num_of_models && status == 0; i++) {
+      status = peekFiles(&training[i], &model_info[i]);
+      if (status == 0 && model_info[i].attributes != data_info.attributes) {
+        printf("error\n");
+        free(model_info);
+        freeTraining(training, num_of_models);
+        free(model_paths);
+        return 0;
+      }
+    }
+    for (i = 0; i < filter.count && status == 0; i++) {
+      if (filter.predicates[i].attribute > data_info.attributes) {
+        fprintf(stderr, "--filter: there is no attribute %d, the data has %d\n", filter.predicates[i].attribute,
+                data_info.attributes);
+        status = -1;
+      }
+    }
+    for (i = 0; i < sensitivity.count && status == 0; i++) {
+      if (sensitivity.variants[i].attribute > data_info.attributes) {
+        fprintf(stderr, "--vary: there is no attribute %d, the data has %d\n", sensitivity.variants[i].attribute,
+                data_info.attributes);
+        status = -1;
+      }
+    }
+    if (status != 0) {
+      free(model_info);
+      freeTraining(training, num_of_models);
+      free(model_paths);
+      return 1;
+    }
+
+    Resources resources;
+    Cost costs[MODE_OOC + 1];
+    int chosen;
+
+    detectResources(&resources, threads);
+
+    // the reference is checked alongside whichever kind of scoring follows
+    Metrics metrics;
+    Metrics * checking = NULL;
+
+    if (ref_path != NULL && !plan_only) {
+      if (openMetrics(&metrics, ref_path, num_of_models) != 0) {
+        free(model_info);
+        freeTraining(training, num_of_models);
+        free(model_paths);
+        return 1;
+      }
+      checking = &metrics;
+    }
+
+    // keyed rows fit a model per group instead, always streaming
+    if (keyed) {
+      status = groupBy(&model_info[0], &data_info, &resources, checking);
+      if (checking != NULL) {
+        status = closeMetrics(checking, status);
+      }
+      free(model_info);
+      freeTraining(training, num_of_models);
+      free(model_paths);
+      return status == 0 ? 0 : 1;
+    }
+
+    estimateCosts(model_info, num_of_models, &data_info, &resources, costs);
+    chosen = mode != MODE_AUTO ? mode : choosePlan(costs, resources.memory);
+    if (chosen == MODE_OOC && spillInMemory()) {
+      fprintf(stderr, "warning: %s is in memory, so out-of-core frees none; point TMPDIR at a disk\n", spillDir());
+    }
+
+    if (plan_only) {
+      printPlan(model_info, num_of_models, &data_info, &resources, costs, chosen, mode != MODE_AUTO);
+      free(model_info);
+      freeTraining(training, num_of_models);
+      free(model_paths);
+      return 0;
+    }
+
+    int num_of_attributes = data_info.attributes;
+    double ** weights = allocMatrix(num_of_attributes + 1, num_of_models);
+
+    if (chosen == MODE_OOC) {
+      spill_bytes = spillThreshold(num_of_attributes);
+    }
+
+    // with --interval the (single) model also brings what its bounds need
+    Spread spread = { NULL, 0, interval };
+    Spread * intervals = interval > 0 ? &spread : NULL;
+    const Sensitivity * varying = sensitivity.count > 0 ? &sensitivity : NULL;
+
+    // with --deadline the models get equal shares of the time, counted from
+    // the start
+    for (i = 0; i < num_of_models; i++) {
+      int attributes;
+      double until = deadline > 0 ? started + deadline * (i + 1) / num_of_models : 0;
+      double ** vector_w = train(&training[i], &attributes, chosen, threadsFor(&resources, model_info[i].bytes),
+                                 intervals, until);
+      if (vector_w == NULL) {
+        freeMatrix(weights);
+        if (checking != NULL) {
+          closeMetrics(checking, -1);
+        }
+        free(model_info);
+        freeTraining(training, num_of_models);
+        free(model_paths);
+        return 1;
+      }
+
+      for (j = 0; j < num_of_attributes + 1; j++) {
+        weights[j][i] = vector_w[j][0];
+      }
+      freeMatrix(vector_w);
+    }
+    spill_bytes = 0;
+
+    free(model_info);
+    freeTraining(training, num_of_models);
+    free(model_paths);
+
+    if (serving) {
+      status = serve(weights, num_of_attributes, num_of_models, port, socket_path, http_port, resources.threads);
+      freeMatrix(weights);
+      return status == 0 ? 0 : 1;
+    }
+
+    if (following) {
+      status = follow(data_path, state_path, weights, num_of_attributes, num_of_models, intervals, varying);
+      freeMatrix(weights);
+      freeMatrix(spread.lower);
+      return status == 0 ? 0 : 1;
+    }
+
+    // ----- SHOULD BE DONE WITH TRAINING DATA SET ----------
+
+    FILE * file2;
+    file2 = fopen(data_path, "r");
+    if (file2 == NULL) {
+      perror(data_path);
+      freeMatrix(weights);
+      freeMatrix(spread.lower);
+      if (checking != NULL) {
+        closeMetrics(checking, -1);
+      }
+      return 1;
+    }
+
+    Reader reader;
+    initReader(&reader, file2, data_path);
+
+    int num_of_attributes_2 = 0, num_of_houses_2 = 0;
+
+    char data[16] = "";
+    status = readHeader(&reader, data, sizeof(data), &num_of_attributes_2, &num_of_houses_2);
+
+    // an index of the data file, if there is one, or with --index one to
+    // build as it is scored. --rows needs one first
+    RowIndex index;
+    RowIndex * building = NULL;
+    int indexed = 0;
+    long long start = readerOffset(&reader), end = -1;
+    long line = reader.line;
+
+    initIndex(&index, 0);
+    threads = threadsFor(&resources, data_info.bytes);
+    if (status == 0) {
+      indexed = loadIndex(data_path, &index) && index.header.attributes == num_of_attributes;
+      if (!indexed && ranged) {
+        freeIndex(&index);
+        status = buildIndex(&reader, &index, num_of_attributes);
+        indexed = status == 0;
+        if (indexed && indexing) {
+          saveIndex(data_path, &index);
+        }
+      } else if (!indexed && indexing) {
+        freeIndex(&index);
+        initIndex(&index, num_of_attributes);
+        building = &index;
+      }
+    }
+
+    if (status == 0 && ranged) {
+      long long rows = index.header.rows;
+      last_row = last_row >= 0 ? last_row : rows;
+      if (last_row > rows) {
+        fprintf(stderr, "%s: --rows %lld:%lld is past the last row (%lld)\n", data_path, first_row, last_row,
+                rows);
+        status = -1;
+      } else if (first_row < last_row) {
+        long last_line;
+        start = rowOffset(&reader, &index, first_row, &line);
+        end = rowOffset(&reader, &index, last_row, &last_line);
+        if (start < 0 || end < 0 || seekReader(&reader, start, end) != 0) {
+          perror(data_path);
+          status = -1;
+        }
+        reader.line = line;
+        reader.origin = 0;
+      }
+      num_of_houses_2 = (int) (last_row - first_row);
+    }
+
+    TopK top;
+    TopK * ranking = top_k > 0 ? &top : NULL;
+    if (ranking != NULL) {
+      initTop(ranking, top_k, intervals != NULL ? 3 : varying != NULL ? sensitivity.count + 1 : num_of_models);
+    }
+
+    const Filter * filtering = filter.count > 0 ? &filter : NULL;
+
+    if (status == 0 && filtering != NULL && indexed && !ranged) {
+      status = predictMatching(&reader, &index, weights, num_of_attributes, num_of_models, intervals, varying,
+                               filtering, ranking);
+    } else if (status == 0 && num_of_houses_2 > 0 && threads > 1) {
+      status = predictParallel(data_path, start, end, line, weights, num_of_attributes, num_of_houses_2,
+                               num_of_models, intervals, varying, checking, threads, resources.chunk_bytes,
+                               indexed ? &index : NULL, building, filtering, ranking);
+    } else if (status == 0 && (num_of_houses_2 > 0 || !ranged)) {
+      status = predict(&reader, weights, num_of_attributes, num_of_houses_2, num_of_models, intervals, varying,
+                       checking, building, filtering, ranking);
+    }
+    if (ranking != NULL) {
+      if (status == 0) {
+        printTop(ranking);
+      }
+      freeTop(ranking);
+    }
+    if (status == 0 && building != NULL) {
+      saveIndex(data_path, building);
+    }
+    freeIndex(&index);
+    if (checking != NULL) {
+      status = closeMetrics(checking, status);
+    }
+
+    freeReader(&reader);
+    fclose(file2);
+    freeMatrix(weights);
+    freeMatrix(spread.lower);
+
+    return status == 0 ? 0 : 1;
 
 }